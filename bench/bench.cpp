@@ -0,0 +1,473 @@
+#include "utils.h"
+#include "file_io.h"
+
+#include <chrono>
+#include <cstdio>
+
+// Stage benchmarks on deterministic synthetic frames. Each stage runs in
+// isolation over the whole clip, the best of several runs is kept, and the
+// results go to stdout as JSON so runs from two builds can be diffed.
+// Round trips of geometries and modes the clip does not cover are checked
+// first; a failure ends the run with status 1.
+//
+// Usage: smp_bench [frames] [repeat]
+
+namespace
+{
+
+constexpr int QUALITY = 50;
+
+struct StageResult
+{
+    const char* name;
+    double seconds;
+    size_t bytes;
+    size_t blocks;
+};
+
+/// Planar RGB frames of a smooth gradient with a moving square and a
+/// little LCG noise, so every stage sees realistic but reproducible input.
+std::vector<uint8_t> makeFrames(const FrameGeometry& geometry, size_t numFrames)
+{
+    std::vector<uint8_t> frames(geometry.frameBytes() * numFrames);
+    const size_t pixelCount = geometry.pixels();
+    uint32_t state = 12345;
+
+    for (size_t frame = 0; frame < numFrames; ++frame)
+    {
+        uint8_t* rgb = frames.data() + frame * geometry.frameBytes();
+        const size_t squareX = (frame * 4) % (geometry.width - 64);
+        const size_t squareY = geometry.height / 3;
+
+        for (size_t y = 0; y < geometry.height; ++y)
+        {
+            for (size_t x = 0; x < geometry.width; ++x)
+            {
+                state = state * 1664525u + 1013904223u;
+                int noise = static_cast<int>(state >> 29) - 4;
+                bool square = x - squareX < 64 && y - squareY < 64;
+                size_t i = y * geometry.width + x;
+
+                rgb[i] = static_cast<uint8_t>(LIMIT(static_cast<int>(square ? 220 : x * 255 / geometry.width) + noise));
+                rgb[i + pixelCount] = static_cast<uint8_t>(LIMIT(static_cast<int>(square ? 40 : y * 255 / geometry.height) + noise));
+                rgb[i + 2 * pixelCount] = static_cast<uint8_t>(LIMIT(static_cast<int>((x + y + frame) & 0xFF) + noise));
+            }
+        }
+    }
+    return frames;
+}
+
+template <typename Work>
+double bestOf(unsigned repeat, Work&& work)
+{
+    double best = 0;
+    for (unsigned run = 0; run < repeat; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = (0 == run || seconds < best) ? seconds : best;
+    }
+    return best;
+}
+
+/// Encodes and decodes a clip in memory with `options` and returns the
+/// PSNR of the result; `payloadBytes` gets the size of the frame payloads
+/// and, for rANS, `estimatedBytes` what rate control expected them to be.
+double roundTripPsnr(const EncoderOptions& options, const std::vector<uint8_t>& frames, size_t& payloadBytes,
+                     size_t& estimatedBytes)
+{
+    const FrameGeometry& geometry = options.geometry;
+    const size_t frameBytes = geometry.frameBytes();
+    EncoderBuffers encoderBuffers(geometry);
+    DecoderBuffers decoderBuffers(geometry);
+    decoderBuffers.entropy = options.entropy;
+    EncodedFrame encodedFrame;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> rgbFrame(frameBytes);
+    double squaredError = 0;
+    payloadBytes = 0;
+    estimatedBytes = 0;
+
+    for (size_t frame = 0; frame < frames.size() / frameBytes; ++frame)
+    {
+        const uint8_t* input = frames.data() + frame * frameBytes;
+        encodeFrame(input, frame, options, encoderBuffers, encodedFrame);
+        payload = encodedFrame.header;
+        payload.insert(payload.end(), encodedFrame.data.begin(), encodedFrame.data.end());
+        payloadBytes += payload.size();
+        if (EntropyMode::RANS == options.entropy)
+        {
+            estimatedBytes += ransPayloadSize(encoderBuffers.coefficients.data(), nullptr, geometry);
+        }
+
+        if (!decodeFrame(payload.data(), payload.size(), encodedFrame.frameType, encodedFrame.quality, geometry,
+                         decoderBuffers, rgbFrame.data()))
+        {
+            return 0;
+        }
+        for (size_t i = 0; i < frameBytes; ++i)
+        {
+            double error = static_cast<double>(input[i]) - rgbFrame[i];
+            squaredError += error * error;
+        }
+    }
+
+    double mse = squaredError / static_cast<double>(frames.size());
+    return 0 == mse ? 99.0 : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+/// Round trips that the timed clip does not exercise; exits on failure.
+void checkRoundTrips()
+{
+    EncoderOptions options;
+    options.quality = 90;
+    size_t payloadBytes = 0;
+    size_t estimatedBytes = 0;
+
+    // Odd widths leave subsampled chroma rows one sample past half width.
+    options.geometry.width = 101;
+    options.geometry.height = 51;
+    const std::vector<uint8_t> oddFrames = makeFrames(options.geometry, 4);
+    for (ChromaMode chroma : {ChromaMode::CHROMA_422, ChromaMode::CHROMA_420})
+    {
+        options.geometry.chroma = chroma;
+        double psnr = roundTripPsnr(options, oddFrames, payloadBytes, estimatedBytes);
+        if (25.0 > psnr)
+        {
+            std::cerr << "Round trip of 101x51 with chroma mode " << static_cast<int>(chroma) << " failed: PSNR "
+                      << psnr << " dB" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    // A flat clip has a single symbol in every table but the intra DC
+    // ones, which rANS has to code in next to no bits.
+    options.geometry = FrameGeometry();
+    std::vector<uint8_t> flatFrames(options.geometry.frameBytes() * 4);
+    for (size_t i = 0; i < flatFrames.size(); ++i)
+    {
+        flatFrames[i] = static_cast<uint8_t>(60 + 70 * (i / options.geometry.pixels() % 3));
+    }
+    size_t huffmanBytes = 0;
+    roundTripPsnr(options, flatFrames, huffmanBytes, estimatedBytes);
+    options.entropy = EntropyMode::RANS;
+    double psnr = roundTripPsnr(options, flatFrames, payloadBytes, estimatedBytes);
+    // The estimate is allowed a few bytes per frame.
+    if (40.0 > psnr || payloadBytes > huffmanBytes || payloadBytes > estimatedBytes + 16 * 4)
+    {
+        std::cerr << "rANS round trip of a flat clip failed: PSNR " << psnr << " dB, " << payloadBytes
+                  << " bytes, estimated " << estimatedBytes << ", Huffman " << huffmanBytes << std::endl;
+        std::exit(1);
+    }
+}
+
+/// Calls visit(component, blockIndex, flatIndex) for every block of a frame,
+/// in the coefficient buffer's order.
+template <typename Visit>
+void forEachBlock(const FrameGeometry& geometry, Visit&& visit)
+{
+    size_t flatIndex = 0;
+    for (int component = 0; component < 3; ++component)
+    {
+        for (size_t idx = 0; idx < geometry.plane(component).blocks(); ++idx, ++flatIndex)
+        {
+            visit(component, idx, flatIndex);
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const size_t numFrames = 1 < argc ? std::strtoul(argv[1], nullptr, 10) : GOP_SIZE;
+    const unsigned repeat = 2 < argc ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 5;
+    if (0 == numFrames || 0 == repeat)
+    {
+        std::cerr << "Usage: smp_bench [frames] [repeat]" << std::endl;
+        return 1;
+    }
+    checkRoundTrips();
+
+    FrameGeometry geometry;
+    const size_t frameBytes = geometry.frameBytes();
+    const size_t totalBlocks = geometry.totalBlocks();
+    const size_t clipBytes = frameBytes * numFrames;
+    const size_t clipBlocks = totalBlocks * numFrames;
+    const std::vector<uint8_t> frames = makeFrames(geometry, numFrames);
+
+    EncoderOptions options;
+    options.geometry = geometry;
+    options.quality = QUALITY;
+
+    // Inputs of every stage, computed once so each stage is timed alone.
+    std::vector<BlockPlanes> samples(numFrames, BlockPlanes(geometry));
+    std::vector<AlignedVector<float>> transformed(numFrames, AlignedVector<float>(totalBlocks * 64));
+    std::vector<std::vector<CoefficientBlock>> transformedInt(numFrames, std::vector<CoefficientBlock>(totalBlocks));
+    std::vector<AlignedVector<int16_t>> coefficients(numFrames, AlignedVector<int16_t>(totalBlocks * 64));
+    std::vector<EncodedFrame> encoded(numFrames);
+    std::vector<uint8_t> rowScratch;
+
+    for (size_t frame = 0; frame < numFrames; ++frame)
+    {
+        if (0 < frame)
+        {
+            samples[frame] = samples[frame - 1];
+        }
+        convertFrameToBlocks(frames.data() + frame * frameBytes, geometry, samples[frame], 0 != frame % GOP_SIZE,
+                             rowScratch);
+
+        forEachBlock(geometry, [&](int component, size_t idx, size_t flatIndex)
+        {
+            float block[8][8];
+            loadBlock(samples[frame].block(component, idx), block);
+            FDCT_2D(block);
+            std::memcpy(&transformed[frame][flatIndex * 64], block, sizeof(block));
+
+            loadBlock(samples[frame].block(component, idx), transformedInt[frame][flatIndex]);
+            FDCT_2D_int(transformedInt[frame][flatIndex]);
+
+            componentQuantizer(component, QUALITY).quantize(block, &coefficients[frame][flatIndex * 64]);
+        });
+        encodeCoefficients(coefficients[frame].data(), nullptr, geometry, encoded[frame]);
+    }
+
+    // Folded into the output so no stage can be optimized away.
+    uint64_t checksum = 0;
+    std::vector<StageResult> results;
+
+    BlockPlanes scratch(geometry);
+    results.push_back({"convert_to_blocks", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            convertFrameToBlocks(frames.data() + frame * frameBytes, geometry, scratch, 0 != frame % GOP_SIZE,
+                                 rowScratch);
+        }
+        checksum += scratch.planes[0][0];
+    }), clipBytes, clipBlocks});
+
+    results.push_back({"fdct_float", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            forEachBlock(geometry, [&](int component, size_t idx, size_t)
+            {
+                float block[8][8];
+                loadBlock(samples[frame].block(component, idx), block);
+                FDCT_2D(block);
+                checksum += static_cast<uint64_t>(block[0][0]);
+            });
+        }
+    }), clipBlocks * 64, clipBlocks});
+
+    results.push_back({"fdct_float_x8", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            for (int component = 0; component < 3; ++component)
+            {
+                const size_t numBlocks = geometry.plane(component).blocks();
+                for (size_t first = 0; first + 8 <= numBlocks; first += 8)
+                {
+                    float batch[8][8][8];
+                    for (size_t k = 0; k < 8; ++k)
+                    {
+                        loadBlock(samples[frame].block(component, first + k), batch[k]);
+                    }
+                    FDCT_2D_x8(batch);
+                    checksum += static_cast<uint64_t>(batch[7][0][0]);
+                }
+            }
+        }
+    }), clipBlocks * 64, clipBlocks});
+
+    results.push_back({"fdct_int", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            forEachBlock(geometry, [&](int component, size_t idx, size_t)
+            {
+                CoefficientBlock block;
+                loadBlock(samples[frame].block(component, idx), block);
+                FDCT_2D_int(block);
+                checksum += static_cast<uint16_t>(block[0]);
+            });
+        }
+    }), clipBlocks * 64, clipBlocks});
+
+    AlignedVector<int16_t> quantized(totalBlocks * 64);
+    results.push_back({"quantize_float", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            forEachBlock(geometry, [&](int component, size_t, size_t flatIndex)
+            {
+                const float* block = &transformed[frame][flatIndex * 64];
+                componentQuantizer(component, QUALITY).quantize(reinterpret_cast<const float (*)[8]>(block),
+                                                                &quantized[flatIndex * 64]);
+            });
+            checksum += static_cast<uint16_t>(quantized[0]);
+        }
+    }), clipBlocks * 64 * sizeof(float), clipBlocks});
+
+    results.push_back({"quantize_int", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            forEachBlock(geometry, [&](int component, size_t, size_t flatIndex)
+            {
+                componentQuantizer(component, QUALITY).quantize(transformedInt[frame][flatIndex],
+                                                                &quantized[flatIndex * 64]);
+            });
+            checksum += static_cast<uint16_t>(quantized[0]);
+        }
+    }), clipBlocks * 64 * sizeof(int16_t), clipBlocks});
+
+    EncodedFrame scratchFrame;
+    results.push_back({"entropy_encode", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            encodeCoefficients(coefficients[frame].data(), nullptr, geometry, scratchFrame);
+            checksum += scratchFrame.data.size();
+        }
+    }), clipBlocks * 64 * sizeof(int16_t), clipBlocks});
+
+    results.push_back({"rans_encode", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            ransEncodeCoefficients(coefficients[frame].data(), nullptr, geometry, scratchFrame);
+            checksum += scratchFrame.data.size();
+        }
+    }), clipBlocks * 64 * sizeof(int16_t), clipBlocks});
+
+    size_t encodedBytes = 0;
+    std::vector<std::vector<uint8_t>> payloads(numFrames);
+    for (size_t frame = 0; frame < numFrames; ++frame)
+    {
+        payloads[frame] = encoded[frame].header;
+        payloads[frame].insert(payloads[frame].end(), encoded[frame].data.begin(), encoded[frame].data.end());
+        encodedBytes += payloads[frame].size();
+    }
+
+    HuffmanDecodeTable dcTable;
+    HuffmanDecodeTable acTable;
+    results.push_back({"entropy_decode", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            if (!decodeCoefficients(payloads[frame].data(), payloads[frame].size(), geometry, nullptr,
+                                    dcTable, acTable, quantized.data()))
+            {
+                std::cerr << "Entropy decoding failed" << std::endl;
+                std::exit(1);
+            }
+            checksum += static_cast<uint16_t>(quantized[0]);
+        }
+    }), encodedBytes, clipBlocks});
+
+    size_t ransBytes = 0;
+    std::vector<std::vector<uint8_t>> ransPayloads(numFrames);
+    for (size_t frame = 0; frame < numFrames; ++frame)
+    {
+        ransEncodeCoefficients(coefficients[frame].data(), nullptr, geometry, scratchFrame);
+        ransPayloads[frame] = scratchFrame.header;
+        ransPayloads[frame].insert(ransPayloads[frame].end(), scratchFrame.data.begin(), scratchFrame.data.end());
+        ransBytes += ransPayloads[frame].size();
+    }
+
+    RansDecodeTable ransTables[2];
+    results.push_back({"rans_decode", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            if (!ransDecodeCoefficients(ransPayloads[frame].data(), ransPayloads[frame].size(), geometry, nullptr,
+                                        ransTables, quantized.data()))
+            {
+                std::cerr << "rANS decoding failed" << std::endl;
+                std::exit(1);
+            }
+            checksum += static_cast<uint16_t>(quantized[0]);
+        }
+    }), ransBytes, clipBlocks});
+
+    results.push_back({"idct", bestOf(repeat, [&]()
+    {
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            forEachBlock(geometry, [&](int, size_t, size_t flatIndex)
+            {
+                float block[8][8];
+                std::memcpy(block, &transformed[frame][flatIndex * 64], sizeof(block));
+                IDCT_2D(block);
+                checksum += static_cast<uint64_t>(block[0][0] + 1024.0f);
+            });
+        }
+    }), clipBlocks * 64 * sizeof(float), clipBlocks});
+
+    const std::string outputPath = (fs::temp_directory_path() / "smp_bench.out").string();
+    results.push_back({"file_write", bestOf(repeat, [&]()
+    {
+        OutputWriter outputFile;
+        if (!outputFile.open(outputPath))
+        {
+            std::cerr << "Failed to open " << outputPath << std::endl;
+            std::exit(1);
+        }
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            outputFile.write(frames.data() + frame * frameBytes, frameBytes);
+        }
+        checksum += outputFile.position();
+        outputFile.close();
+    }), clipBytes, 0});
+    fs::remove(outputPath);
+
+    results.push_back({"encode_frames", bestOf(repeat, [&]()
+    {
+        EncoderBuffers buffers(geometry);
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            encodeFrame(frames.data() + frame * frameBytes, frame, options, buffers, scratchFrame);
+            checksum += scratchFrame.data.size();
+        }
+    }), clipBytes, clipBlocks});
+
+    std::vector<uint8_t> rgbFrame(frameBytes);
+    results.push_back({"decode_frames", bestOf(repeat, [&]()
+    {
+        DecoderBuffers buffers(geometry);
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            uint8_t frameType = 0 == frame % GOP_SIZE ? FRAME_INTRA : FRAME_INTER;
+            if (!decodeFrame(payloads[frame].data(), payloads[frame].size(), frameType, QUALITY, geometry,
+                             buffers, rgbFrame.data()))
+            {
+                std::cerr << "Frame decoding failed" << std::endl;
+                std::exit(1);
+            }
+            checksum += rgbFrame[0];
+        }
+    }), clipBytes, clipBlocks});
+
+    std::printf("{\n");
+    std::printf("  \"width\": %zu,\n  \"height\": %zu,\n  \"frames\": %zu,\n", geometry.width, geometry.height, numFrames);
+    std::printf("  \"quality\": %d,\n  \"repeat\": %u,\n  \"encoded_bytes\": %zu,\n", QUALITY, repeat, encodedBytes);
+    std::printf("  \"stages\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const StageResult& result = results[i];
+        std::printf("    {\"name\": \"%s\", \"seconds\": %.6f, \"mb_per_s\": %.2f", result.name, result.seconds,
+                    result.bytes / result.seconds / 1e6);
+        if (0 != result.blocks)
+        {
+            std::printf(", \"ns_per_block\": %.2f", result.seconds * 1e9 / result.blocks);
+        }
+        std::printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ],\n  \"checksum\": %llu\n}\n", static_cast<unsigned long long>(checksum));
+    return 0;
+}
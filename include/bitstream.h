@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/// MSB-first bit writer. Codes are shifted into a 64-bit accumulator and
+/// whole 32-bit words are stored big-endian into a caller-provided buffer,
+/// which must be large enough for the final stream rounded up to 4 bytes.
+class BitWriter
+{
+public:
+    explicit BitWriter(uint8_t* buffer)
+        : out(buffer), pos(0), accumulator(0), bitCount(0) {}
+
+    /// Appends the low `length` bits of `bits`, most significant first.
+    /// `length` must not exceed 32.
+    inline void put(uint32_t bits, unsigned length)
+    {
+        accumulator = (accumulator << length) | bits;
+        bitCount += length;
+        if (32 <= bitCount)
+        {
+            bitCount -= 32;
+            uint32_t word = static_cast<uint32_t>(accumulator >> bitCount);
+            out[pos + 0] = static_cast<uint8_t>(word >> 24);
+            out[pos + 1] = static_cast<uint8_t>(word >> 16);
+            out[pos + 2] = static_cast<uint8_t>(word >> 8);
+            out[pos + 3] = static_cast<uint8_t>(word);
+            pos += 4;
+        }
+    }
+
+    /// Pads the pending bits with zeroes to a byte boundary, writes them out
+    /// and returns the total number of bytes produced.
+    inline size_t flush()
+    {
+        while (0 < bitCount)
+        {
+            unsigned take = bitCount < 8 ? bitCount : 8;
+            bitCount -= take;
+            out[pos++] = static_cast<uint8_t>(((accumulator >> bitCount) << (8 - take)) & 0xFF);
+        }
+        accumulator = 0;
+        return pos;
+    }
+
+private:
+    uint8_t* out;
+    size_t pos;
+    uint64_t accumulator;
+    unsigned bitCount;
+};
+
+/// MSB-first bit reader matching BitWriter. The accumulator is kept
+/// left-aligned and refilled eight bytes at a time; reads past the end of
+/// the buffer yield zero bits and are reported by overrun().
+class BitReader
+{
+public:
+    BitReader(const uint8_t* buffer, size_t size)
+        : data(buffer), size(size), pos(0), accumulator(0), bitCount(0) {}
+
+    /// Tops the accumulator up to at least 56 valid bits.
+    inline void refill()
+    {
+        if (pos + 8 <= size)
+        {
+            uint64_t next;
+            std::memcpy(&next, data + pos, sizeof(next));
+            next = __builtin_bswap64(next);
+            accumulator |= next >> bitCount;
+            pos += (63 - bitCount) >> 3;
+            bitCount |= 56;
+        }
+        else
+        {
+            while (56 >= bitCount)
+            {
+                uint64_t byte = pos < size ? data[pos] : 0;
+                accumulator |= byte << (56 - bitCount);
+                ++pos;
+                bitCount += 8;
+            }
+        }
+    }
+
+    /// Returns the next `length` bits (1..32) without consuming them.
+    inline uint32_t peek(unsigned length) const
+    {
+        return static_cast<uint32_t>(accumulator >> (64 - length));
+    }
+
+    inline void skip(unsigned length)
+    {
+        accumulator <<= length;
+        bitCount -= length;
+    }
+
+    /// True once more bits were consumed than the buffer holds.
+    inline bool overrun() const
+    {
+        return pos > size && (pos - size) * 8 > bitCount;
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    uint64_t accumulator;
+    unsigned bitCount;
+};
@@ -0,0 +1,223 @@
+#pragma once
+#include "utils.h"
+#include "bitstream.h"
+
+/// Coefficient scan and symbol alphabet shared by the entropy coders: the
+/// symbols of a frame and how blocks are rebuilt from them do not depend
+/// on how the symbols themselves are coded.
+namespace coefficient_scan
+{
+
+constexpr unsigned DC_TABLE = 0;
+constexpr unsigned AC_TABLE = 1;
+
+/// AC symbols are (run << 4) | size, JPEG style: `run` zero coefficients
+/// followed by a nonzero one of magnitude category `size`. EOB ends a block
+/// whose remaining coefficients are all zero, ZRL stands for 16 zeroes.
+constexpr uint8_t EOB = 0x00;
+constexpr uint8_t ZRL = 0xF0;
+
+/// Magnitude categories of clamped coefficients, and of DC differences,
+/// which span twice the range.
+constexpr unsigned MAX_AC_SIZE = 11;
+constexpr unsigned MAX_DC_SIZE = MAX_AC_SIZE + 1;
+static_assert(Quantizer::COEFFICIENT_LIMIT < (1 << MAX_AC_SIZE), "AC magnitude categories too small");
+
+/// Block index of each frequency along one axis: the FDCT leaves its
+/// outputs in the order 0 4 2 6 5 1 7 3.
+constexpr uint8_t FREQUENCY_POSITION[8] = {0, 5, 2, 7, 1, 4, 3, 6};
+
+/// Zigzag scan in frequency order, mapped to positions in the transformed
+/// block, so coefficients are visited from low to high frequency.
+constexpr std::array<uint8_t, 64> makeScanOrder()
+{
+    std::array<uint8_t, 64> order{};
+    size_t k = 0;
+    for (int diagonal = 0; diagonal < 15; ++diagonal)
+    {
+        for (int i = 0; i <= diagonal; ++i)
+        {
+            int u = (diagonal % 2) ? i : diagonal - i;
+            int v = diagonal - u;
+            if (u < 8 && v < 8)
+            {
+                order[k++] = static_cast<uint8_t>(FREQUENCY_POSITION[u] * 8 + FREQUENCY_POSITION[v]);
+            }
+        }
+    }
+    return order;
+}
+
+constexpr std::array<uint8_t, 64> SCAN_ORDER = makeScanOrder();
+static_assert(0 == SCAN_ORDER[0], "the scan must start at the DC coefficient");
+
+/// Number of bits needed for |value|.
+inline unsigned magnitudeSize(int value)
+{
+    unsigned magnitude = static_cast<unsigned>(value < 0 ? -value : value);
+    return 0 == magnitude ? 0 : 32 - __builtin_clz(magnitude);
+}
+
+/// Low `size` bits of the value; negative values are stored as value - 1,
+/// so their top bit is clear.
+inline uint32_t magnitudeBits(int value, unsigned size)
+{
+    return static_cast<uint32_t>(value < 0 ? value - 1 : value) & ((1u << size) - 1);
+}
+
+inline int extendMagnitude(uint32_t bits, unsigned size)
+{
+    int value = static_cast<int>(bits);
+    return bits < (1u << (size - 1)) ? value - (1 << size) + 1 : value;
+}
+
+/// Turns the quantized blocks into symbols, calling
+/// emit(table, symbol, bits, size) for each one, where `bits` holds the
+/// `size` magnitude bits that follow the symbol's code. The DC coefficient
+/// is predicted from the previous coded block of the same component plane;
+/// blocks flagged in `skip`, if given, are left out.
+template <typename Emit>
+void scanCoefficients(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry, Emit&& emit)
+{
+    for (int component = 0; component < 3; ++component)
+    {
+        const size_t numBlocks = geometry.plane(component).blocks();
+        int predictor = 0;
+
+        for (size_t blockIndex = 0; blockIndex < numBlocks; ++blockIndex, coefficients += 64)
+        {
+            if (skip && *skip++)
+            {
+                continue;
+            }
+
+            int difference = coefficients[0] - predictor;
+            predictor = coefficients[0];
+            unsigned size = magnitudeSize(difference);
+            emit(DC_TABLE, static_cast<uint8_t>(size), magnitudeBits(difference, size), size);
+
+            unsigned run = 0;
+            for (size_t k = 1; k < 64; ++k)
+            {
+                int value = coefficients[SCAN_ORDER[k]];
+                if (0 == value)
+                {
+                    ++run;
+                    continue;
+                }
+                for (; 16 <= run; run -= 16)
+                {
+                    emit(AC_TABLE, ZRL, 0, 0);
+                }
+                size = magnitudeSize(value);
+                emit(AC_TABLE, static_cast<uint8_t>((run << 4) | size), magnitudeBits(value, size), size);
+                run = 0;
+            }
+            if (0 != run)
+            {
+                emit(AC_TABLE, EOB, 0, 0);
+            }
+        }
+    }
+}
+
+/// Bytes of packed skip flags at the start of a FRAME_INTER_SKIP payload.
+inline size_t skipFlagBytes(const FrameGeometry& geometry)
+{
+    return (geometry.totalBlocks() + 7) / 8;
+}
+
+
+/// Unpacks the skip flags at the start of a FRAME_INTER_SKIP payload and
+/// returns the number of coded blocks.
+inline size_t unpackSkipFlags(const uint8_t* payload, const FrameGeometry& geometry, uint8_t* skip)
+{
+    size_t codedBlocks = geometry.totalBlocks();
+    for (size_t blockIndex = 0; blockIndex < geometry.totalBlocks(); ++blockIndex)
+    {
+        skip[blockIndex] = (payload[blockIndex / 8] >> (7 - blockIndex % 8)) & 1;
+        codedBlocks -= skip[blockIndex];
+    }
+    return codedBlocks;
+}
+
+inline void packSkipFlags(const uint8_t* skip, const FrameGeometry& geometry, uint8_t* payload)
+{
+    for (size_t blockIndex = 0; blockIndex < geometry.totalBlocks(); ++blockIndex)
+    {
+        payload[blockIndex / 8] |= static_cast<uint8_t>(skip[blockIndex] << (7 - blockIndex % 8));
+    }
+}
+
+inline int readMagnitude(BitReader& reader, unsigned size)
+{
+    if (0 == size)
+    {
+        return 0;
+    }
+    uint32_t bits = reader.peek(size);
+    reader.skip(size);
+    return extendMagnitude(bits, size);
+}
+
+/// Rebuilds the quantized blocks from their symbols, the inverse of
+/// scanCoefficients(). `source.symbol(table, symbol)` reads the next
+/// symbol of a table and `source.magnitude(size)` the magnitude bits that
+/// follow it; a failed read or an invalid symbol fails the frame.
+template <typename Source>
+bool parseCoefficients(const FrameGeometry& geometry, const uint8_t* skip, int16_t* coefficients, Source& source)
+{
+    for (int component = 0; component < 3; ++component)
+    {
+        const size_t numBlocks = geometry.plane(component).blocks();
+        int predictor = 0;
+
+        for (size_t blockIndex = 0; blockIndex < numBlocks; ++blockIndex, coefficients += 64)
+        {
+            if (skip && *skip++)
+            {
+                continue;
+            }
+
+            std::fill(coefficients, coefficients + 64, 0);
+
+            uint16_t symbol;
+            if (!source.symbol(DC_TABLE, symbol) || MAX_DC_SIZE < symbol)
+            {
+                return false;
+            }
+            predictor += source.magnitude(symbol);
+            coefficients[0] = static_cast<int16_t>(predictor);
+
+            for (size_t k = 1; k < 64;)
+            {
+                if (!source.symbol(AC_TABLE, symbol))
+                {
+                    return false;
+                }
+
+                unsigned run = symbol >> 4;
+                unsigned magnitude = symbol & 0xF;
+                if (EOB == symbol)
+                {
+                    break;
+                }
+                if (ZRL == symbol)
+                {
+                    k += 16;
+                    continue;
+                }
+
+                k += run;
+                if (0 == magnitude || MAX_AC_SIZE < magnitude || 64 <= k)
+                {
+                    return false;
+                }
+                coefficients[SCAN_ORDER[k++]] = static_cast<int16_t>(source.magnitude(magnitude));
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace coefficient_scan
@@ -0,0 +1,81 @@
+#pragma once
+#include "utils.h"
+
+#include <functional>
+
+/// Receives output in chunks; returns false to fail the writer.
+using ChunkSink = std::function<bool(const uint8_t* data, size_t size)>;
+
+/// Read-only memory mapping of a whole file. The mapping is advised for
+/// sequential access, so frames can be consumed in place while the kernel
+/// reads ahead.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// Maps `path`; `hugePages` additionally asks for transparent huge pages
+    /// where the kernel and file system support them.
+    bool open(const std::string& path, bool hugePages = false);
+    void close();
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+};
+
+/// Output file written through a large aligned buffer, so a stream becomes
+/// a few big write() calls. The byte position is tracked as data is
+/// appended, which is what frame records use for their offsets. Instead of
+/// a file, the writer can hand its buffer to a ChunkSink.
+class OutputWriter
+{
+public:
+    static constexpr size_t BUFFER_SIZE = 4u << 20;
+
+    OutputWriter();
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    bool open(const std::string& path);
+    bool open(ChunkSink chunkSink);
+    /// Flushes the buffer and closes the file; false if any write failed.
+    bool close();
+    /// Passes everything buffered so far on to the file or sink.
+    void flush();
+
+    void write(const void* data, size_t size);
+
+    template <typename T>
+    void writeValue(const T& value)
+    {
+        write(&value, sizeof(value));
+    }
+
+    /// Absolute offset of the next byte written.
+    uint64_t position() const { return written + used; }
+    bool good() const { return !failed; }
+
+private:
+    void writeThrough(const uint8_t* data, size_t size);
+
+    AlignedVector<uint8_t> buffer;
+    ChunkSink sink;
+    size_t used;
+    uint64_t written;
+    int fd;
+    bool failed;
+};
+
+/// Closes `outputFile` and deletes `path`, so a failed run does not leave
+/// a truncated file behind.
+void discardOutput(OutputWriter& outputFile, const std::string& path);
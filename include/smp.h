@@ -0,0 +1,86 @@
+#pragma once
+#include "utils.h"
+#include "file_io.h"
+
+#include <memory>
+
+/// Encoder session for embedding the codec. Frames are read from caller
+/// memory and the stream is handed to a ChunkSink: the stream header when
+/// a clip begins, one chunk per frame record, and the index, if asked for,
+/// when it ends. Scratch buffers and the output buffer are kept across
+/// frames and clips; they are only reallocated when the frame size
+/// changes. Frames are encoded on the calling thread.
+class SmpEncoder
+{
+public:
+    SmpEncoder();
+
+    SmpEncoder(const SmpEncoder&) = delete;
+    SmpEncoder& operator=(const SmpEncoder&) = delete;
+
+    /// Starts a clip. The frame count goes into the stream header, and rate
+    /// control spreads its budget over it.
+    bool begin(const EncoderOptions& options, uint32_t numFrames, ChunkSink sink);
+    /// Encodes one planar RGB24 frame of geometry.frameBytes() bytes.
+    bool pushFrame(const uint8_t* rgbFrame);
+    /// Ends the clip; false if frames are missing or the sink failed.
+    bool finish();
+
+    uint32_t framesPushed() const { return static_cast<uint32_t>(frameIndex); }
+
+private:
+    EncoderOptions options;
+    std::unique_ptr<EncoderBuffers> buffers;
+    EncodedFrame encodedFrame;
+    OutputWriter output;
+    FrameIndex index;
+    uint32_t numFrames;
+    size_t frameIndex;
+    bool active;
+};
+
+/// Decoder session over a complete stream in caller memory, which has to
+/// outlive the session. Frames are decoded in order into caller memory;
+/// buffers and Huffman tables are kept across frames and streams.
+/// decodeGroups() decodes the rest of the stream on a thread pool instead.
+class SmpDecoder
+{
+public:
+    SmpDecoder();
+
+    SmpDecoder(const SmpDecoder&) = delete;
+    SmpDecoder& operator=(const SmpDecoder&) = delete;
+
+    /// Reads the stream header and frame index; on failure error() says why.
+    bool open(const uint8_t* stream, size_t size, RunStats* stats = nullptr);
+    /// Decodes the next frame into geometry().frameBytes() bytes of planar
+    /// RGB24.
+    bool nextFrame(uint8_t* rgbFrame);
+    /// Decodes the remaining frames on `threads` workers and hands them to
+    /// `sink` in order, one geometry().frameBytes() chunk of planar RGB24
+    /// per frame, on the calling thread. Each intra frame starts a group
+    /// that decodes on its own; decoded groups waiting for the sink are
+    /// capped at 2 * threads and at about 1 GiB of frames.
+    bool decodeGroups(unsigned threads, const ChunkSink& sink);
+
+    const FrameGeometry& geometry() const { return frameGeometry; }
+    uint32_t frameCount() const { return header.numFrames; }
+    size_t framesDecoded() const { return frameIndex; }
+    const std::string& error() const { return message; }
+
+private:
+    /// Decodes record `frame` with the given buffers, which hold the state
+    /// left by the frame before it unless `frame` is intra.
+    bool decodeFrameAt(size_t frame, DecoderBuffers& frameBuffers, uint8_t* rgbFrame) const;
+    void addFrameStats(size_t frame) const;
+
+    const uint8_t* stream;
+    size_t size;
+    RunStats* stats;
+    StreamHeader header;
+    FrameIndex index;
+    FrameGeometry frameGeometry;
+    std::unique_ptr<DecoderBuffers> buffers;
+    size_t frameIndex;
+    std::string message;
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/// What --stats prints once the run is over.
+enum class StatsMode
+{
+    OFF,
+    TEXT,
+    JSON
+};
+
+/// Pipeline stages timed by --stats.
+enum class Stage
+{
+    CONVERT,
+    TRANSFORM,
+    RATE_CONTROL,
+    QUANTIZE,
+    ENTROPY_ENCODE,
+    ENTROPY_DECODE,
+    RECONSTRUCT,
+    COLOR_OUTPUT,
+    WRITE,
+    COUNT
+};
+
+/// Counters of one frame record. The entropy counters are only filled in
+/// by the encoder.
+struct FrameStats
+{
+    uint8_t frameType = 0;
+    uint8_t quality = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint32_t codedBlocks = 0;
+    uint32_t symbols = 0;
+    uint64_t codeBits = 0;
+    uint16_t dcCodes = 0;
+    uint16_t acCodes = 0;
+    /// DC and AC tables taken over from the previous frame, 0 to 2.
+    uint8_t reusedTables = 0;
+};
+
+/// Statistics of one run, for --stats. Stage times and frames may be added
+/// from any thread; stage times are summed over threads, and frames are
+/// listed in the order they were written.
+class RunStats
+{
+public:
+    RunStats();
+
+    RunStats(const RunStats&) = delete;
+    RunStats& operator=(const RunStats&) = delete;
+
+    void addStageTime(Stage stage, uint64_t wallNs, uint64_t cpuNs);
+    void addFrame(const FrameStats& frame);
+
+    /// Writes run totals, peak RSS, stage times and frame counters, as text
+    /// or as JSON with one entry per frame.
+    void report(std::ostream& out, bool json) const;
+
+private:
+    struct StageTotals
+    {
+        std::atomic<uint64_t> wallNs{0};
+        std::atomic<uint64_t> cpuNs{0};
+        std::atomic<uint64_t> calls{0};
+    };
+
+    std::chrono::steady_clock::time_point start;
+    StageTotals stages[static_cast<size_t>(Stage::COUNT)];
+    mutable std::mutex framesMutex;
+    std::vector<FrameStats> frames;
+};
+
+/// CPU time consumed by the calling thread.
+uint64_t threadCpuNanoseconds();
+
+/// Times a stage for as long as it is in scope. Without a RunStats no clock
+/// is read, so disabled instrumentation costs a null check.
+class StageTimer
+{
+public:
+    StageTimer(RunStats* stats, Stage stage)
+        : stats(stats), stage(stage), cpuStart(0)
+    {
+        if (nullptr != stats)
+        {
+            wallStart = std::chrono::steady_clock::now();
+            cpuStart = threadCpuNanoseconds();
+        }
+    }
+
+    ~StageTimer()
+    {
+        if (nullptr != stats)
+        {
+            auto wall = std::chrono::steady_clock::now() - wallStart;
+            stats->addStageTime(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count(),
+                                threadCpuNanoseconds() - cpuStart);
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    RunStats* stats;
+    Stage stage;
+    std::chrono::steady_clock::time_point wallStart;
+    uint64_t cpuStart;
+};
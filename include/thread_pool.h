@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed-size work-stealing pool. Every worker has its own task deque and
+/// runs it oldest first; a worker whose deque is empty steals the newest
+/// task of another one. Tasks submitted from outside the pool are dealt
+/// round-robin, tasks submitted by a worker go to its own deque.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    struct WorkQueue
+    {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    void workerLoop(size_t worker);
+    bool takeTask(size_t worker, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue;
+    /// Tasks queued but not yet claimed by a worker.
+    size_t pending;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping;
+};
@@ -9,9 +9,8 @@
 #include <fstream>
 #include <cstring>
 #include <array>
-#include <queue>
-#include <unordered_map>
-#include <bitset>
+#include <utility>
+#include "stats.h"
 
 namespace fs = std::filesystem;
 
@@ -20,18 +19,34 @@ namespace fs = std::filesystem;
 #define CIF_Y 288
 #define CIF_SIZE (CIF_X * CIF_Y)
 #define RGB_CIF_SIZE (CIF_SIZE* 3)
+#define GOP_SIZE 32
+#define HUFFMAN_HEADER_SIZE 128
+#define HUFFMAN_MAX_CODE_LENGTH 15
 
 #define LIMIT(X) ( (X) < 0 ? 0 : (X) > 255 ? 255 : X )
 
-#define FP_YUV2R(Y, Cb, Cr)  LIMIT( Y                      + 1.402   * (Cr-128) )
-#define FP_YUV2G(Y, Cb, Cr)  LIMIT( Y - 0.34414 * (Cb-128) - 0.71414 * (Cr-128) )
-#define FP_YUV2B(Y, Cb, Cr)  LIMIT( Y + 1.772   * (Cb-128)						)
+/// RGB -> YCbCr weights (JFIF) in Q14 fixed point, rounded so each row
+/// sums exactly to 1.0 (Y) or 0.0 (Cb, Cr).
+constexpr int RGB2YCC_BITS = 14;
+constexpr int RGB2YCC_HALF = 1 << (RGB2YCC_BITS - 1);
+constexpr int RGB2Y_R  =  4899, RGB2Y_G  =  9617, RGB2Y_B  =  1868;
+constexpr int RGB2CB_R = -2765, RGB2CB_G = -5427, RGB2CB_B =  8192;
+constexpr int RGB2CR_R =  8192, RGB2CR_G = -6860, RGB2CR_B = -1332;
 
-#define FP_RGB2Y(R, G, B)   LIMIT(       (0.299    * R) + 0.587    * G + (0.114    * B) )
-#define FP_RGB2Cb(R, G, B)  LIMIT( 128 - (0.168736 * R) - 0.331264 * G + (0.5      * B) )
-#define FP_RGB2Cr(R, G, B)  LIMIT( 128 + (0.5      * R) - 0.418688 * G - (0.081312 * B) )
+#define FIX_RGB2Y(R, G, B)   LIMIT( ( RGB2Y_R  * (R) + RGB2Y_G  * (G) + RGB2Y_B  * (B) + RGB2YCC_HALF ) >> RGB2YCC_BITS )
+#define FIX_RGB2Cb(R, G, B)  LIMIT( ( RGB2CB_R * (R) + RGB2CB_G * (G) + RGB2CB_B * (B) + (128 << RGB2YCC_BITS) + RGB2YCC_HALF ) >> RGB2YCC_BITS )
+#define FIX_RGB2Cr(R, G, B)  LIMIT( ( RGB2CR_R * (R) + RGB2CR_G * (G) + RGB2CR_B * (B) + (128 << RGB2YCC_BITS) + RGB2YCC_HALF ) >> RGB2YCC_BITS )
+
+/// YCbCr -> RGB weights (JFIF: 1.402, 0.34414, 0.71414, 1.772) in the same
+/// Q14 fixed point. Results are floored, as the encoder's tuning assumes.
+constexpr int YCC2R_CR = 22970, YCC2G_CB = -5638, YCC2G_CR = -11700, YCC2B_CB = 29032;
+
+#define FIX_YUV2R(Y, Cb, Cr)  LIMIT( ( ((Y) << RGB2YCC_BITS) + YCC2R_CR * ((Cr) - 128) ) >> RGB2YCC_BITS )
+#define FIX_YUV2G(Y, Cb, Cr)  LIMIT( ( ((Y) << RGB2YCC_BITS) + YCC2G_CB * ((Cb) - 128) + YCC2G_CR * ((Cr) - 128) ) >> RGB2YCC_BITS )
+#define FIX_YUV2B(Y, Cb, Cr)  LIMIT( ( ((Y) << RGB2YCC_BITS) + YCC2B_CB * ((Cb) - 128) ) >> RGB2YCC_BITS )
 
 #define DPCM_8BIT(A, B) (((B-A) + 256) / 2)
+#define IDPCM_8BIT(D, B) LIMIT( (B) + 256 - 2 * (D) )
 
 /// ci = cos(i*pi/16)
 #define c1 0.9807852804032304491262 // cos(pi/16)
@@ -42,18 +57,95 @@ namespace fs = std::filesystem;
 #define c6 0.3826834323650897717285 // cos(6*pi/16) = cos(3*pi/8)
 #define c7 0.1950903220161282678483 // cos(7*pi/16)
 
-struct HuffmanNode
+/// FDCT butterfly constants and the final per-output scale factors, folded
+/// to float once and shared by the scalar and SIMD kernels.
+constexpr float FDCT_C4 = c4;
+constexpr float FDCT_C6 = c6;
+constexpr float FDCT_C2_MINUS_C6 = c2 - c6;
+constexpr float FDCT_C2_PLUS_C6 = c2 + c6;
+constexpr float FDCT_SCALE[8] =
+{
+    1 / ( 2 * M_SQRT2 ), 1 / ( 4 * c4 ), 1 / ( 4 * c2 ), 1 / ( 4 * c6 ),
+    1 / ( 4 * c5 ),      1 / ( 4 * c1 ), 1 / ( 4 * c7 ), 1 / ( 4 * c3 )
+};
+
+/// The inverses for IDCT_2D: input scale factors and butterfly constants.
+constexpr float IDCT_SCALE[8] =
+{
+    2 * M_SQRT2, 4 * c4, 4 * c2, 4 * c6,
+    4 * c5,      4 * c1, 4 * c7, 4 * c3
+};
+constexpr float IDCT_C2 = c2;
+constexpr float IDCT_C6 = c6;
+constexpr float IDCT_INV_C4 = 1 / c4;
+
+struct HuffmanCode
 {
-    uint8_t data;
-    size_t frequency;
-    HuffmanNode* left;
-    HuffmanNode* right;
+    uint32_t bits;
+    uint8_t length;
+};
+
+using HuffmanCodeTable = std::array<HuffmanCode, 256>;
+using HuffmanHistogram = std::array<size_t, 256>;
+
+/// Two-level lookup table for canonical Huffman decoding: the next
+/// PRIMARY_BITS of the stream index `primary` directly, and codes longer
+/// than that continue into a 2^(MAX_BITS - PRIMARY_BITS) overflow table.
+struct HuffmanDecodeTable
+{
+    static constexpr unsigned PRIMARY_BITS = 11;
+    static constexpr unsigned MAX_BITS = HUFFMAN_MAX_CODE_LENGTH;
+    static constexpr uint8_t INVALID_LENGTH = 0xFF;
 
-    HuffmanNode(uint8_t data, size_t frequency)
-        : data(data), frequency(frequency), left(nullptr), right(nullptr) {}
+    struct Entry
+    {
+        uint16_t value;  // symbol, or overflow table base when length is 0
+        uint8_t length;
+    };
+
+    std::array<Entry, 1u << PRIMARY_BITS> primary;
+    std::vector<Entry> overflow;
+    /// Set by a successful build(), so a frame can reuse the table.
+    bool valid = false;
+
+    bool build(const uint8_t* header);
 };
 
-const unsigned char TABEL_QUANTIZARE_Y[8][8] =
+/// DC and AC codes of the last frame of a group that sent them, which the
+/// following inter frames may reuse instead of sending their own.
+struct HuffmanTables
+{
+    HuffmanCodeTable codes[2];
+    bool valid = false;
+};
+
+/// Entropy coder of a stream, recorded in the high nibble of the chroma
+/// byte of the stream header.
+enum class EntropyMode : uint8_t
+{
+    HUFFMAN = 0,
+    RANS = 1
+};
+
+/// Static rANS model of one symbol alphabet, as read from a frame: the
+/// frequencies sum to 1 << SCALE_BITS, every slot of that range holds its
+/// symbol, and each symbol its first slot (high half) and frequency (low
+/// half). Both tables of a frame take 10 KB, so they stay in L1.
+struct RansDecodeTable
+{
+    static constexpr unsigned SCALE_BITS = 12;
+
+    std::array<uint8_t, 1u << SCALE_BITS> slots;
+    std::array<uint32_t, 256> ranges;
+    /// False for a table without symbols.
+    bool valid = false;
+
+    /// Reads a serialized table; returns the bytes it took, or 0 if it is
+    /// malformed.
+    size_t read(const uint8_t* data, size_t size);
+};
+
+constexpr unsigned char TABEL_QUANTIZARE_Y[8][8] =
 {
     16,11,10,16,24, 40, 51, 61,
     12,12,14,19,26, 58, 60, 55,
@@ -65,7 +157,7 @@ const unsigned char TABEL_QUANTIZARE_Y[8][8] =
     72,92,95,98,112,100,103,99
 };
 
-const unsigned char TABEL_QUANTIZARE_CbCr[8][8] =
+constexpr unsigned char TABEL_QUANTIZARE_CbCr[8][8] =
 {
     17,18,24,47,99,99,99,99,
     18,21,26,66,99,99,99,99,
@@ -87,47 +179,432 @@ struct YCbCr
     uint8_t y, cb, cr;
 };
 
-struct Compare
+/// Allocator for buffers that SIMD kernels stream through, aligned to a
+/// cache line.
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
 {
-    bool operator()(HuffmanNode* a, HuffmanNode* b)
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
     {
-        return a->frequency > b->frequency;
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
     }
+
+    void deallocate(T* pointer, size_t)
+    {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/// Chroma sampling of a stream; the value is stored in the stream header.
+enum class ChromaMode : uint8_t
+{
+    CHROMA_444 = 0,
+    CHROMA_422 = 1, // Cb and Cr at half width
+    CHROMA_420 = 2  // Cb and Cr at half width and half height
+};
+
+/// Size of one component plane and the grid of 8x8 blocks covering it.
+/// Sizes that are not a multiple of 8 are padded up to whole blocks.
+struct PlaneGeometry
+{
+    size_t width;
+    size_t height;
+
+    size_t samples() const { return width * height; }
+    size_t blocksPerRow() const { return (width + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+    size_t blockRows() const { return (height + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+    size_t blocks() const { return blocksPerRow() * blockRows(); }
+    size_t paddedWidth() const { return blocksPerRow() * BLOCK_SIZE; }
+    size_t paddedHeight() const { return blockRows() * BLOCK_SIZE; }
+};
+
+/// Frame size in pixels and chroma sampling. plane() is the component
+/// map: component 0 is luma at full size, 1 and 2 are Cb and Cr at the
+/// chroma resolution, rounded up for odd sizes.
+struct FrameGeometry
+{
+    size_t width = CIF_X;
+    size_t height = CIF_Y;
+    ChromaMode chroma = ChromaMode::CHROMA_444;
+
+    size_t pixels() const { return width * height; }
+    /// Size of one planar RGB24 frame.
+    size_t frameBytes() const { return 3 * pixels(); }
+
+    PlaneGeometry plane(int component) const
+    {
+        if (0 == component || ChromaMode::CHROMA_444 == chroma)
+        {
+            return {width, height};
+        }
+        return {(width + 1) / 2, ChromaMode::CHROMA_420 == chroma ? (height + 1) / 2 : height};
+    }
+
+    size_t totalBlocks() const { return plane(0).blocks() + plane(1).blocks() + plane(2).blocks(); }
+
+    bool operator==(const FrameGeometry& other) const
+    {
+        return width == other.width && height == other.height && chroma == other.chroma;
+    }
+    bool operator!=(const FrameGeometry& other) const { return !(*this == other); }
 };
 
+/// Runs Kernel<Width, Height>::run(plane, args...) with the plane size as
+/// compile-time constants for the common sizes, so their strides fold and
+/// row loops unroll; any other size uses the Kernel<0, 0> runtime version.
+template <template <size_t, size_t> class Kernel, typename... Args>
+void dispatchPlaneGeometry(const PlaneGeometry& plane, Args&&... args)
+{
+    if (352 == plane.width && 288 == plane.height)
+    {
+        Kernel<352, 288>::run(plane, std::forward<Args>(args)...);
+    }
+    else if (704 == plane.width && 576 == plane.height)
+    {
+        Kernel<704, 576>::run(plane, std::forward<Args>(args)...);
+    }
+    else if (1280 == plane.width && 720 == plane.height)
+    {
+        Kernel<1280, 720>::run(plane, std::forward<Args>(args)...);
+    }
+    else if (1920 == plane.width && 1080 == plane.height)
+    {
+        Kernel<1920, 1080>::run(plane, std::forward<Args>(args)...);
+    }
+    else
+    {
+        Kernel<0, 0>::run(plane, std::forward<Args>(args)...);
+    }
+}
+
+/// A frame in block order, one plane per component: every 8x8 block of a
+/// component is stored as 64 contiguous samples, blocks in raster order.
+struct BlockPlanes
+{
+    AlignedVector<uint8_t> planes[3];
+    size_t blocksPerPlane[3] = {0, 0, 0};
+
+    BlockPlanes() = default;
+    explicit BlockPlanes(const FrameGeometry& geometry);
+
+    uint8_t* block(int component, size_t index) { return planes[component].data() + index * BLOCK_SIZE * BLOCK_SIZE; }
+    const uint8_t* block(int component, size_t index) const { return planes[component].data() + index * BLOCK_SIZE * BLOCK_SIZE; }
+};
+
+/// Position of pixel (x, y) inside a BlockPlanes plane whose block grid is
+/// `paddedWidth` samples wide.
+constexpr size_t blockSampleIndex(size_t x, size_t y, size_t paddedWidth)
+{
+    return ((y / BLOCK_SIZE) * (paddedWidth / BLOCK_SIZE) + x / BLOCK_SIZE) * BLOCK_SIZE * BLOCK_SIZE
+           + (y % BLOCK_SIZE) * BLOCK_SIZE + x % BLOCK_SIZE;
+}
+
+/// One 8x8 block of int16 samples or coefficients in raster order.
+using CoefficientBlock = std::array<int16_t, 64>;
+
+/// Quality scaling of one base quantization table entry, IJG style:
+/// quality 50 keeps the table, lower qualities coarsen it, higher refine it.
+constexpr uint16_t scaleQuantValue(unsigned char base, int quality)
+{
+    int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+    int value = (base * scale + 50) / 100;
+    return static_cast<uint16_t>(value < 1 ? 1 : value);
+}
+
+/// Quantization table of one component at one quality, scaled once, with
+/// the reciprocals the quantize kernels multiply by instead of dividing.
+/// The integer path computes (|c| + d/2) * multiplier >> MULTIPLIER_BITS,
+/// which equals (|c| + d/2) / d for any int16 coefficient.
+struct Quantizer
+{
+    static constexpr unsigned MULTIPLIER_BITS = 32;
+    /// Quantized coefficients are clamped to +-COEFFICIENT_LIMIT, which
+    /// bounds the magnitude categories the entropy coder has to handle.
+    static constexpr int16_t COEFFICIENT_LIMIT = 2047;
+
+    alignas(16) std::array<float, 64> reciprocal{};
+    std::array<uint64_t, 64> multiplier{};
+    std::array<uint16_t, 64> divisor{};
+
+    constexpr Quantizer(const unsigned char (&quantTable)[8][8], int quality)
+    {
+        for (size_t i = 0; i < 64; ++i)
+        {
+            uint16_t d = scaleQuantValue(quantTable[i / 8][i % 8], quality);
+            divisor[i] = d;
+            reciprocal[i] = 1.0f / d;
+            multiplier[i] = ((uint64_t{1} << MULTIPLIER_BITS) + d - 1) / d;
+        }
+    }
+
+    /// Quantizes and clamps the 64 coefficients of a block into
+    /// `coefficients`, keeping the transform's layout.
+    void quantize(const float block[8][8], int16_t* coefficients) const;
+    void quantize(const CoefficientBlock& block, int16_t* coefficients) const;
+    /// Inverse of quantize(): quantized back to scaled coefficients.
+    void dequantize(const int16_t* coefficients, float block[8][8]) const;
+};
+
+/// Quantizer for a component (0 luma, 1-2 chroma) at quality 1..100. The
+/// tables for the two standard quantization tables are built at compile
+/// time, so nothing is scaled at run time.
+const Quantizer& componentQuantizer(int component, int quality);
+
+/// Scratch state for encoding one frame, sized once for the frame geometry
+/// and reused. `samples` keeps the stored samples between calls because they
+/// are the next frame's DPCM reference; `coefficients` holds the quantized
+/// blocks, component plane by component plane, and `transformed` or
+/// `transformedInt` the same blocks before quantization, for the float and
+/// the fixed-point DCT. Block skipping allocates the rest on first use:
+/// `reference` keeps the last coded version of every block, `current` the
+/// frame being encoded before DPCM, and `skip` a flag per block. `tables`
+/// are the codes inter frames of the current group may reuse.
+struct EncoderBuffers
+{
+    FrameGeometry geometry;
+    BlockPlanes samples;
+    AlignedVector<int16_t> coefficients;
+    AlignedVector<float> transformed;
+    std::vector<CoefficientBlock> transformedInt;
+    BlockPlanes reference;
+    BlockPlanes current;
+    std::vector<uint8_t> skip;
+    /// Row scratch of convertFrameToBlocks().
+    std::vector<uint8_t> rowScratch;
+    HuffmanTables tables;
+
+    explicit EncoderBuffers(const FrameGeometry& geometry);
+};
+
+/// Frame record types. Inter frames are DPCM against the previous frame;
+/// FRAME_INTER_SKIP payloads start with one skip flag per block, packed
+/// MSB first, and only the blocks not skipped are coded.
+constexpr uint8_t FRAME_INTRA = 0;
+constexpr uint8_t FRAME_INTER = 1;
+constexpr uint8_t FRAME_INTER_SKIP = 2;
+
+/// Flags in the high bits of the type byte of an inter frame: the frame
+/// reuses the last DC or AC code sent in its group, and that code-length
+/// header is left out of the payload.
+constexpr uint8_t FRAME_TYPE_MASK = 0x0F;
+constexpr uint8_t FRAME_REUSE_DC_TABLE = 0x10;
+constexpr uint8_t FRAME_REUSE_AC_TABLE = 0x20;
+
+/// One entropy-coded frame: the skip flags of a FRAME_INTER_SKIP frame and
+/// the 128-byte nibble code-length headers of the DC and AC codes it does
+/// not reuse, followed by the packed bitstream. `stats` holds its counters for --stats.
+struct EncodedFrame
+{
+    uint8_t frameType = FRAME_INTRA;
+    uint8_t quality = 50;
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> data;
+    FrameStats stats;
+};
+
+/// Scratch state for decoding one frame, one raster plane per component at
+/// its own resolution. `planes` holds the decoded stored samples, which are
+/// the next frame's DPCM reference once swapped into `prevPlanes`;
+/// `pixels` holds them after inverse DPCM.
+struct DecoderBuffers
+{
+    std::vector<int16_t> coefficients;
+    std::vector<uint8_t> skip;
+    std::vector<uint8_t> planes[3];
+    std::vector<uint8_t> prevPlanes[3];
+    std::vector<uint8_t> pixels[3];
+    HuffmanDecodeTable dcTable;
+    HuffmanDecodeTable acTable;
+    RansDecodeTable ransTables[2];
+    /// Entropy coder of the stream being decoded.
+    EntropyMode entropy = EntropyMode::HUFFMAN;
+
+    explicit DecoderBuffers(const FrameGeometry& geometry);
+};
+
+enum class DctMode
+{
+    FLOAT,
+    INTEGER
+};
+
+struct EncoderOptions
+{
+    FrameGeometry geometry;
+    int quality = 50;
+    unsigned threads = 1;
+    DctMode dct = DctMode::FLOAT;
+    EntropyMode entropy = EntropyMode::HUFFMAN;
+    bool writeIndex = false;
+    /// Inter-frame blocks whose sum of absolute differences from the last
+    /// coded version of the block is at most this are skipped; negative
+    /// disables skipping.
+    int skipThreshold = -1;
+    /// Rate control: a budget for the whole stream in bytes, or a bitrate in
+    /// bits per second at `fps` frames per second. With either, `quality`
+    /// is the highest quality a frame may use.
+    uint64_t targetBytes = 0;
+    uint64_t bitrate = 0;
+    unsigned fps = 25;
+    /// Byte budget of each frame record, derived from the above by
+    /// compress(); 0 keeps every frame at `quality`.
+    uint64_t frameBudget = 0;
+    /// Collects stage times and frame counters when set.
+    RunStats* stats = nullptr;
+};
+
+/// Fixed header at the start of every SMP stream: "SMP", u16 width,
+/// u16 height, u32 frame count, int quality and a byte holding the chroma
+/// mode in its low and the entropy coder in its high nibble. Each frame
+/// record carries the quality it was coded at; the header holds the
+/// highest one allowed.
+struct StreamHeader
+{
+    static constexpr size_t SIZE = 3 + 2 + 2 + 4 + 4 + 1;
+
+    uint16_t width = CIF_X;
+    uint16_t height = CIF_Y;
+    uint32_t numFrames = 0;
+    int quality = 50;
+    ChromaMode chroma = ChromaMode::CHROMA_444;
+    EntropyMode entropy = EntropyMode::HUFFMAN;
+};
+
+/// Location of one frame record: `offset` is where its nextFrameOffset
+/// field starts and `size` covers the whole record, prefix and payload.
+struct FrameIndexEntry
+{
+    uint64_t offset;
+    uint32_t size;
+    uint8_t frameType;
+};
+
+/// Per-frame index, optionally stored as a footer after the last frame:
+/// "SMPI", u32 count, count entries of u64 offset, u32 size, u8 type, then
+/// a trailer of the u64 footer offset and "SMPX" ending the file.
+using FrameIndex = std::vector<FrameIndexEntry>;
+
+/// Bytes before the payload of a frame record: nextFrameOffset, type and
+/// quality.
+constexpr size_t FRAME_RECORD_PREFIX = sizeof(uint64_t) + 2 * sizeof(uint8_t);
+
 enum class CommandUsed
 {
     FIRST       = 0,
     HELP        = FIRST + 0,
     COMPRESS    = FIRST + 1,
     DECOMPRESS  = FIRST + 2,
-    UNKNOWN     = FIRST + 3,
+    EXTRACT     = FIRST + 3,
+    BATCH       = FIRST + 4,
+    UNKNOWN     = FIRST + 5,
     LAST
 };
 
+class OutputWriter;
+
 CommandUsed findCommand(std::string command);
+bool parseStatsOption(const std::string& arg, StatsMode& mode);
 void printHelp(void);
 YCbCr rgbToYuv(const RGB& rgb);
 RGB yuvToRgb(const YCbCr& ycbcr);
-void vectorTo2DArray(const std::vector<float>& vec, float array[8][8]);
-std::array<std::array<float, 8>, 8> convertToStdArray(float var[8][8]);
+void loadBlock(const uint8_t* samples, float block[8][8]);
+void loadBlock(const uint8_t* samples, CoefficientBlock& block);
+
+/// Returns false, and removes the output file, if encoding failed.
+bool compress(const std::string& inputFilePath, const std::string& outputFilePath, EncoderOptions options);
+
+/// One clip of a batch run.
+struct BatchJob
+{
+    std::string inputPath;
+    std::string outputPath;
+};
+
+/// Compresses every job with the same options on one shared pool of
+/// options.threads workers; false if any clip failed.
+bool compressBatch(const std::vector<BatchJob>& jobs, const EncoderOptions& options);
+/// Lists the clips of `input`, either a directory of .rgb files or a
+/// manifest with one input path per line, each compressed to a file of the
+/// same name in `outputDirectory`, which is created if needed.
+bool collectBatchJobs(const fs::path& input, const fs::path& outputDirectory, std::vector<BatchJob>& jobs);
+/// Byte budget of each frame record for the rate control options, 0 if
+/// there is none.
+uint64_t rateControlBudget(const EncoderOptions& options, uint32_t numFrames);
+void writeFrameRecord(OutputWriter& outputFile, size_t frameIndex, uint32_t numFrames,
+                      const EncodedFrame& encodedFrame, FrameIndex& index, RunStats* stats);
+using EncodedGroup = std::vector<EncodedFrame>;
+EncodedGroup encodeGroup(const uint8_t* frames, size_t groupIndex, uint32_t numFrames, const EncoderOptions& options);
+bool compressGroupsParallel(const uint8_t* frames, OutputWriter& outputFile, uint32_t numFrames,
+                            const EncoderOptions& options, FrameIndex& index);
 
-void compress(const std::string& inputFilePath, const std::string& outputFilePath, int quality);
+void writeStreamHeader(OutputWriter& outputFile, const StreamHeader& header);
+bool readStreamHeader(const uint8_t* stream, size_t size, StreamHeader& header);
+uint64_t frameIndexBytes(size_t numFrames);
+void writeFrameIndex(OutputWriter& outputFile, const FrameIndex& index);
+bool readFrameIndex(const uint8_t* stream, size_t size, const StreamHeader& header, FrameIndex& index);
+/// Returns false, and removes the output file, if extraction failed.
+bool extractFrames(const std::string& inputFilePath, const std::string& outputFilePath, size_t firstFrame,
+                   size_t endFrame);
 
-//void decompress(const std::string& inputFilePath, const std::string& outputFilePath);
-std::vector<std::vector<YCbCr>> processFramesForCompression(const std::string& inputFilePath);
-std::vector<std::vector<float>> segmentFramesToBlocks(const std::vector<std::vector<YCbCr>>& yuvFrames);
+/// Decodes a stream to planar RGB24, with groups decoded on `threads`
+/// workers. Returns false, and removes the output file, if decoding failed.
+bool decompress(const std::string& inputFilePath, const std::string& outputFilePath, unsigned threads = 1,
+                RunStats* stats = nullptr);
+bool decodeFrame(const uint8_t* payload, size_t size, uint8_t frameType, int quality, const FrameGeometry& geometry,
+                 DecoderBuffers& buffers, uint8_t* rgbFrame, RunStats* stats = nullptr);
+void encodeFrame(const uint8_t* rgbFrame, size_t frameIndex, const EncoderOptions& options,
+                 EncoderBuffers& buffers, EncodedFrame& encodedFrame);
+void processFrameForCompression(const uint8_t* rgbFrame, size_t frameIndex, const FrameGeometry& geometry,
+                                BlockPlanes& samples, std::vector<uint8_t>& rowScratch);
+/// `rowScratch` holds rows between the conversion steps; it is sized on
+/// the first call, so callers keep it across frames.
+void convertFrameToBlocks(const uint8_t* rgbFrame, const FrameGeometry& geometry, BlockPlanes& samples, bool applyDpcm,
+                          std::vector<uint8_t>& rowScratch);
+size_t selectSkippedBlocks(const BlockPlanes& current, BlockPlanes& reference, BlockPlanes& samples,
+                           unsigned threshold, uint8_t* skip);
 void FDCT_2D(float block[8][8]);
+void FDCT_2D_x8(float blocks[8][8][8]);
+void FDCT_2D_int(CoefficientBlock& block);
 void IDCT_2D(float block[8][8]);
-void quantizeBlock(float block[8][8], const unsigned char quantTable[8][8], int quality);
-std::vector<uint8_t> recomposeFrame(const std::vector<std::array<std::array<float, 8>, 8>>& quantizedBlocks);
 
 
-HuffmanNode* buildHuffmanTree(const std::unordered_map<uint8_t, size_t>& frequencies);
-void buildHuffmanCodes(HuffmanNode* root, std::string currentCode, std::unordered_map<uint8_t, std::string>& codes);
-std::string encodeData(const std::vector<uint8_t>& data, const std::unordered_map<uint8_t, std::string>& codes);
-std::vector<uint8_t> encodeHuffman(const std::vector<uint8_t>& data, std::vector<uint8_t>& header);
-std::vector<uint8_t> compressData(const std::string& bitstream);
+void buildCodeLengths(const HuffmanHistogram& frequencies, unsigned maxLength, HuffmanCodeTable& codes);
+void assignCanonicalCodes(HuffmanCodeTable& codes);
+void writeCodeLengths(const HuffmanCodeTable& codes, uint8_t* header);
+void readCodeLengths(const uint8_t* header, HuffmanCodeTable& codes);
+size_t encodedSizeBits(const HuffmanHistogram& frequencies, const HuffmanCodeTable& codes);
+size_t encodedPayloadSize(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                          const HuffmanTables* previous = nullptr);
+void encodeCoefficients(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                        EncodedFrame& encodedFrame, HuffmanTables* tables = nullptr);
+bool decodeCoefficients(const uint8_t* payload, size_t size, const FrameGeometry& geometry, uint8_t* skip,
+                        HuffmanDecodeTable& dcTable, HuffmanDecodeTable& acTable, int16_t* coefficients,
+                        uint8_t tableFlags = 0);
+size_t ransPayloadSize(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry);
+void ransEncodeCoefficients(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                            EncodedFrame& encodedFrame);
+bool ransDecodeCoefficients(const uint8_t* payload, size_t size, const FrameGeometry& geometry, uint8_t* skip,
+                            RansDecodeTable tables[2], int16_t* coefficients);
 
 
 inline std::ostream& operator<<(std::ostream& os, CommandUsed cmd)
@@ -137,6 +614,8 @@ inline std::ostream& operator<<(std::ostream& os, CommandUsed cmd)
         case CommandUsed::HELP:       return os << "HELP";
         case CommandUsed::COMPRESS:   return os << "COMPRESS";
         case CommandUsed::DECOMPRESS: return os << "DECOMPRESS";
+        case CommandUsed::EXTRACT:    return os << "EXTRACT";
+        case CommandUsed::BATCH:      return os << "BATCH";
         case CommandUsed::UNKNOWN:    return os << "UNKNOWN";
         default:                      return os << "INVALID_COMMAND";
     }
@@ -0,0 +1,293 @@
+#include "utils.h"
+#include "file_io.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <memory>
+#include <set>
+
+namespace
+{
+
+/// A clip being encoded. Each of its groups is a separate pool task; the
+/// submitting thread writes them back in stream order.
+struct BatchClip
+{
+    const BatchJob* job = nullptr;
+    MappedFile inputFile;
+    OutputWriter outputFile;
+    EncoderOptions options;
+    uint32_t numFrames = 0;
+    size_t numGroups = 0;
+    size_t frameIndex = 0;
+    FrameIndex index;
+    bool failed = false;
+};
+
+/// A group submitted to the pool, queued in the order it is written.
+struct PendingGroup
+{
+    std::shared_ptr<BatchClip> clip;
+    size_t groupIndex;
+    std::future<EncodedGroup> group;
+};
+
+/// Totals of a batch run.
+struct BatchProgress
+{
+    size_t failedClips = 0;
+    uint64_t frames = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+};
+
+/// Maps the input of `job`, opens its output and writes the stream header;
+/// returns null, counted as a failed clip, if either file cannot be opened.
+std::shared_ptr<BatchClip> openClip(const BatchJob& job, const EncoderOptions& options, BatchProgress& progress)
+{
+    const FrameGeometry& geometry = options.geometry;
+    auto clip = std::make_shared<BatchClip>();
+    clip->job = &job;
+    if (!clip->inputFile.open(job.inputPath, true))
+    {
+        std::cerr << "Failed to open input file: " << job.inputPath << std::endl;
+        ++progress.failedClips;
+        return nullptr;
+    }
+    if (!clip->outputFile.open(job.outputPath))
+    {
+        std::cerr << "Failed to open output file: " << job.outputPath << std::endl;
+        ++progress.failedClips;
+        return nullptr;
+    }
+
+    clip->numFrames = static_cast<uint32_t>(clip->inputFile.size() / geometry.frameBytes());
+    clip->numGroups = (clip->numFrames + GOP_SIZE - 1) / GOP_SIZE;
+    clip->options = options;
+    clip->options.frameBudget = rateControlBudget(options, clip->numFrames);
+    clip->index.reserve(clip->numFrames);
+
+    StreamHeader streamHeader;
+    streamHeader.width = static_cast<uint16_t>(geometry.width);
+    streamHeader.height = static_cast<uint16_t>(geometry.height);
+    streamHeader.numFrames = clip->numFrames;
+    streamHeader.quality = options.quality;
+    streamHeader.chroma = geometry.chroma;
+    streamHeader.entropy = options.entropy;
+    writeStreamHeader(clip->outputFile, streamHeader);
+    return clip;
+}
+
+void closeClip(BatchClip& clip, BatchProgress& progress)
+{
+    if (!clip.failed && clip.options.writeIndex)
+    {
+        writeFrameIndex(clip.outputFile, clip.index);
+    }
+    bool written = clip.outputFile.close() && !clip.failed;
+    if (!written)
+    {
+        std::cerr << "Failed to compress " << clip.job->inputPath << std::endl;
+        discardOutput(clip.outputFile, clip.job->outputPath);
+        ++progress.failedClips;
+        return;
+    }
+
+    progress.frames += clip.numFrames;
+    progress.bytesIn += clip.inputFile.size();
+    progress.bytesOut += clip.outputFile.position();
+}
+
+/// Waits for the oldest pending group, writes its frames and closes the
+/// clip after its last group.
+void writeGroup(PendingGroup& pending, BatchProgress& progress)
+{
+    BatchClip& clip = *pending.clip;
+    try
+    {
+        EncodedGroup group = pending.group.get();
+        for (const EncodedFrame& encodedFrame : group)
+        {
+            if (!clip.failed)
+            {
+                writeFrameRecord(clip.outputFile, clip.frameIndex++, clip.numFrames, encodedFrame, clip.index,
+                                 clip.options.stats);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        clip.failed = true;
+    }
+
+    if (pending.groupIndex + 1 == clip.numGroups)
+    {
+        closeClip(clip, progress);
+    }
+}
+
+} // namespace
+
+bool compressBatch(const std::vector<BatchJob>& jobs, const EncoderOptions& options)
+{
+    // Bounds the encoded groups waiting to be written across all clips, the
+    // same way compressGroupsParallel() does for one clip. Only clips with a
+    // group in the window are open, so inputs and output buffers stay
+    // bounded for batches of any length.
+    const size_t maxInFlight = 2 * std::max(1u, options.threads);
+
+    std::cout << "Encoding " << jobs.size() << " clips on " << options.threads << " threads..." << std::endl;
+    auto start = std::chrono::steady_clock::now();
+
+    BatchProgress progress;
+    {
+        ThreadPool pool(options.threads);
+        std::deque<PendingGroup> inFlight;
+        std::shared_ptr<BatchClip> clip;
+        size_t nextGroup = 0;
+        size_t nextJob = 0;
+
+        while (true)
+        {
+            // Groups of the next clip follow those of the previous one, so
+            // workers that finish a short clip move on to the next.
+            while (inFlight.size() < maxInFlight)
+            {
+                if (!clip || nextGroup == clip->numGroups)
+                {
+                    if (jobs.size() == nextJob)
+                    {
+                        break;
+                    }
+                    clip = openClip(jobs[nextJob++], options, progress);
+                    nextGroup = 0;
+                    if (clip && 0 == clip->numGroups)
+                    {
+                        closeClip(*clip, progress);
+                    }
+                    continue;
+                }
+
+                // The pending entry keeps the clip alive until the group is
+                // written, which is after the task has run.
+                auto task = std::make_shared<std::packaged_task<EncodedGroup()>>(
+                    [encoding = clip.get(), groupIndex = nextGroup]()
+                    {
+                        return encodeGroup(encoding->inputFile.data(), groupIndex, encoding->numFrames,
+                                           encoding->options);
+                    });
+                inFlight.push_back({clip, nextGroup, task->get_future()});
+                pool.submit([task]() { (*task)(); });
+                ++nextGroup;
+            }
+
+            if (inFlight.empty())
+            {
+                break;
+            }
+            writeGroup(inFlight.front(), progress);
+            inFlight.pop_front();
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = 0 < seconds ? 1.0 / seconds : 0.0;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Batch completed: " << jobs.size() - progress.failedClips << " of " << jobs.size()
+              << " clips, " << progress.frames << " frames in " << seconds << " s" << std::endl
+              << "Throughput: " << progress.frames * rate << " frames/s, "
+              << progress.bytesIn * rate / 1e6 << " MB/s in, "
+              << progress.bytesOut * rate / 1e6 << " MB/s out" << std::endl;
+    if (0 != progress.bytesOut)
+    {
+        std::cout << "Compression ratio: " << static_cast<double>(progress.bytesIn) / progress.bytesOut << std::endl;
+    }
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout << std::setprecision(6);
+
+    return 0 == progress.failedClips;
+}
+
+bool collectBatchJobs(const fs::path& input, const fs::path& outputDirectory, std::vector<BatchJob>& jobs)
+{
+    if (!input.is_absolute() || !outputDirectory.is_absolute())
+    {
+        std::cerr << "You need to use absolute path!" << std::endl;
+        return false;
+    }
+    if (!fs::exists(input))
+    {
+        std::cerr << "Input does not exist: " << input << std::endl;
+        return false;
+    }
+
+    std::vector<fs::path> inputs;
+    if (fs::is_directory(input))
+    {
+        for (const fs::directory_entry& entry : fs::directory_iterator(input))
+        {
+            if (entry.is_regular_file() && ".rgb" == entry.path().extension())
+            {
+                inputs.push_back(entry.path());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    }
+    else
+    {
+        // Blank lines and lines starting with '#' are skipped.
+        std::ifstream manifest(input);
+        std::string line;
+        for (size_t lineNumber = 1; std::getline(manifest, line); ++lineNumber)
+        {
+            size_t first = line.find_first_not_of(" \t\r");
+            if (std::string::npos == first || '#' == line[first])
+            {
+                continue;
+            }
+            fs::path path(line.substr(first, line.find_last_not_of(" \t\r") + 1 - first));
+            if (!path.is_absolute() || ".rgb" != path.extension() || !fs::is_regular_file(path))
+            {
+                std::cerr << "Manifest line " << lineNumber << " is not an absolute path to an existing .rgb file: "
+                          << path << std::endl;
+                return false;
+            }
+            inputs.push_back(path);
+        }
+    }
+
+    std::error_code error;
+    fs::create_directories(outputDirectory, error);
+    if (!fs::is_directory(outputDirectory))
+    {
+        std::cerr << "Failed to create output directory: " << outputDirectory << std::endl;
+        return false;
+    }
+
+    std::set<fs::path> outputs;
+    for (const fs::path& inputPath : inputs)
+    {
+        fs::path outputPath = outputDirectory / inputPath.filename();
+        if (!outputs.insert(outputPath).second)
+        {
+            std::cerr << "Two inputs would both be written to " << outputPath << std::endl;
+            return false;
+        }
+        if (fs::weakly_canonical(outputPath) == fs::weakly_canonical(inputPath))
+        {
+            std::cerr << "Output would overwrite its input: " << inputPath << std::endl;
+            return false;
+        }
+        jobs.push_back({inputPath.string(), outputPath.string()});
+    }
+
+    if (jobs.empty())
+    {
+        std::cerr << "No .rgb clips found in " << input << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,353 @@
+#include "utils.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+BlockPlanes::BlockPlanes(const FrameGeometry& geometry)
+{
+    for (int component = 0; component < 3; ++component)
+    {
+        blocksPerPlane[component] = geometry.plane(component).blocks();
+        planes[component].resize(blocksPerPlane[component] * BLOCK_SIZE * BLOCK_SIZE);
+    }
+}
+
+namespace
+{
+
+#if defined(__SSE2__)
+/// One output component for 16 pixels. rg[k] holds interleaved (R, G) and
+/// b0[k] holds (B, 0) 16-bit pairs for pixels 4k..4k+3, so two pmaddwd per
+/// quad give kR*R + kG*G + kB*B in 32-bit lanes; the saturating packs then
+/// clamp to 0..255 exactly like LIMIT.
+inline __m128i convertComponent(const __m128i rg[4], const __m128i b0[4], __m128i kRG, __m128i kB0, __m128i bias)
+{
+    __m128i sums[4];
+    for (int k = 0; k < 4; ++k)
+    {
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(rg[k], kRG), _mm_madd_epi16(b0[k], kB0));
+        sums[k] = _mm_srai_epi32(_mm_add_epi32(sum, bias), RGB2YCC_BITS);
+    }
+    return _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+}
+
+inline __m128i pairConstants(int first, int second)
+{
+    return _mm_set1_epi32(static_cast<int>((static_cast<uint32_t>(second) << 16) | (static_cast<uint32_t>(first) & 0xFFFF)));
+}
+
+/// Sums of horizontally adjacent byte pairs of 16 samples, as eight 16-bit
+/// lanes.
+inline __m128i pairSums(const uint8_t* samples)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples));
+    return _mm_add_epi16(_mm_and_si128(v, low), _mm_srli_epi16(v, 8));
+}
+#endif // __SSE2__
+
+/// Converts one row of planar RGB to rows of Y, Cb and Cr.
+void convertRow(const uint8_t* r, const uint8_t* g, const uint8_t* b, size_t width,
+                uint8_t* rowY, uint8_t* rowCb, uint8_t* rowCr)
+{
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i kYRG = pairConstants(RGB2Y_R, RGB2Y_G);
+    const __m128i kYB0 = pairConstants(RGB2Y_B, 0);
+    const __m128i kCbRG = pairConstants(RGB2CB_R, RGB2CB_G);
+    const __m128i kCbB0 = pairConstants(RGB2CB_B, 0);
+    const __m128i kCrRG = pairConstants(RGB2CR_R, RGB2CR_G);
+    const __m128i kCrB0 = pairConstants(RGB2CR_B, 0);
+    const __m128i biasY = _mm_set1_epi32(RGB2YCC_HALF);
+    const __m128i biasC = _mm_set1_epi32((128 << RGB2YCC_BITS) + RGB2YCC_HALF);
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i r8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x));
+        __m128i g8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x));
+        __m128i b8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+
+        __m128i rLo = _mm_unpacklo_epi8(r8, zero);
+        __m128i rHi = _mm_unpackhi_epi8(r8, zero);
+        __m128i gLo = _mm_unpacklo_epi8(g8, zero);
+        __m128i gHi = _mm_unpackhi_epi8(g8, zero);
+        __m128i bLo = _mm_unpacklo_epi8(b8, zero);
+        __m128i bHi = _mm_unpackhi_epi8(b8, zero);
+
+        const __m128i rg[4] =
+        {
+            _mm_unpacklo_epi16(rLo, gLo), _mm_unpackhi_epi16(rLo, gLo),
+            _mm_unpacklo_epi16(rHi, gHi), _mm_unpackhi_epi16(rHi, gHi)
+        };
+        const __m128i b0[4] =
+        {
+            _mm_unpacklo_epi16(bLo, zero), _mm_unpackhi_epi16(bLo, zero),
+            _mm_unpacklo_epi16(bHi, zero), _mm_unpackhi_epi16(bHi, zero)
+        };
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rowY + x), convertComponent(rg, b0, kYRG, kYB0, biasY));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rowCb + x), convertComponent(rg, b0, kCbRG, kCbB0, biasC));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rowCr + x), convertComponent(rg, b0, kCrRG, kCrB0, biasC));
+    }
+#endif // __SSE2__
+
+    // Tail, and the whole row on targets without SSE2.
+    for (; x < width; ++x)
+    {
+        YCbCr pixels = rgbToYuv({r[x], g[x], b[x]});
+        rowY[x] = pixels.y;
+        rowCb[x] = pixels.cb;
+        rowCr[x] = pixels.cr;
+    }
+}
+
+/// Halves a chroma row horizontally for 4:2:2, averaging pixel pairs; an
+/// odd last pixel is kept as is.
+void downsampleRow(const uint8_t* row, size_t width, uint8_t* out)
+{
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    const __m128i one = _mm_set1_epi16(1);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i sum = _mm_srli_epi16(_mm_add_epi16(pairSums(row + x), one), 1);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x / 2), _mm_packus_epi16(sum, sum));
+    }
+#endif // __SSE2__
+
+    for (; x + 1 < width; x += 2)
+    {
+        out[x / 2] = static_cast<uint8_t>((row[x] + row[x + 1] + 1) >> 1);
+    }
+    if (x < width)
+    {
+        out[x / 2] = row[x];
+    }
+}
+
+/// Halves two chroma rows in both directions for 4:2:0 with a 2x2 box
+/// filter; an odd last column averages vertically only.
+void downsampleRows(const uint8_t* upper, const uint8_t* lower, size_t width, uint8_t* out)
+{
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i sum = _mm_add_epi16(pairSums(upper + x), pairSums(lower + x));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x / 2), _mm_packus_epi16(sum, sum));
+    }
+#endif // __SSE2__
+
+    for (; x + 1 < width; x += 2)
+    {
+        out[x / 2] = static_cast<uint8_t>((upper[x] + upper[x + 1] + lower[x] + lower[x + 1] + 2) >> 2);
+    }
+    if (x < width)
+    {
+        out[x / 2] = static_cast<uint8_t>((upper[x] + lower[x] + 1) >> 1);
+    }
+}
+
+/// Writes one raster row into block order: row `y` of a plane whose block
+/// grid is `paddedWidth` wide. With DPCM the samples already there are the
+/// previous frame's and become the reference.
+void storeRow(const uint8_t* row, size_t width, size_t y, size_t paddedWidth, uint8_t* plane, bool applyDpcm)
+{
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xFF));
+    for (; x + BLOCK_SIZE <= width; x += BLOCK_SIZE)
+    {
+        __m128i* sample = reinterpret_cast<__m128i*>(plane + blockSampleIndex(x, y, paddedWidth));
+        __m128i current = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + x));
+        if (applyDpcm)
+        {
+            // DPCM_8BIT(cur, prev) = (prev - cur + 256) >> 1, which is the
+            // rounding average of prev and 255 - cur.
+            current = _mm_avg_epu8(_mm_loadl_epi64(sample), _mm_xor_si128(current, ones));
+        }
+        _mm_storel_epi64(sample, current);
+    }
+#endif // __SSE2__
+
+    for (; x < width; ++x)
+    {
+        uint8_t& sample = plane[blockSampleIndex(x, y, paddedWidth)];
+        sample = applyDpcm ? DPCM_8BIT(row[x], sample) : row[x];
+    }
+}
+
+/// Pads the block grid past the right and bottom plane edges by repeating
+/// the last column and row, which keeps the padding cheap to code.
+void replicateEdges(uint8_t* plane, const PlaneGeometry& geometry)
+{
+    const size_t width = geometry.width;
+    const size_t height = geometry.height;
+    const size_t paddedWidth = geometry.paddedWidth();
+
+    for (size_t y = 0; y < height; ++y)
+    {
+        const uint8_t edge = plane[blockSampleIndex(width - 1, y, paddedWidth)];
+        for (size_t x = width; x < paddedWidth; ++x)
+        {
+            plane[blockSampleIndex(x, y, paddedWidth)] = edge;
+        }
+    }
+    for (size_t y = height; y < geometry.paddedHeight(); ++y)
+    {
+        for (size_t x = 0; x < paddedWidth; ++x)
+        {
+            plane[blockSampleIndex(x, y, paddedWidth)] = plane[blockSampleIndex(x, height - 1, paddedWidth)];
+        }
+    }
+}
+
+/// Colour conversion, chroma downsampling, DPCM and block extraction for
+/// one frame, a row at a time so every row is still in cache when it is
+/// stored. Width and Height are the luma size when known at compile time,
+/// or 0 to read it from `luma`.
+template <size_t Width, size_t Height>
+struct ConvertToBlocks
+{
+    static void run(const PlaneGeometry& luma, const FrameGeometry& geometry, const uint8_t* rgbFrame,
+                    BlockPlanes& samples, bool applyDpcm, std::vector<uint8_t>& scratch);
+};
+
+template <size_t Width, size_t Height>
+void ConvertToBlocks<Width, Height>::run(const PlaneGeometry& luma, const FrameGeometry& geometry,
+                                         const uint8_t* rgbFrame, BlockPlanes& samples, bool applyDpcm,
+                                         std::vector<uint8_t>& scratch)
+{
+    const size_t width = Width ? Width : luma.width;
+    const size_t height = Height ? Height : luma.height;
+    const size_t paddedWidth = (width + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    const size_t pixelCount = width * height;
+    const PlaneGeometry chroma = geometry.plane(1);
+    const size_t chromaPaddedWidth = chroma.paddedWidth();
+
+    const uint8_t* r = rgbFrame;
+    const uint8_t* g = rgbFrame + pixelCount;
+    const uint8_t* b = rgbFrame + 2 * pixelCount;
+    uint8_t* planeY = samples.planes[0].data();
+    uint8_t* planeCb = samples.planes[1].data();
+    uint8_t* planeCr = samples.planes[2].data();
+
+    // Row scratch: Y, two rows each of full-resolution Cb and Cr (4:2:0
+    // filters row pairs), and the downsampled Cb and Cr rows, which are
+    // (width + 1) / 2 wide when subsampled.
+    scratch.resize(5 * width + 2 * chroma.width);
+    uint8_t* rowY = scratch.data();
+    uint8_t* rowsCb[2] = {rowY + width, rowY + 2 * width};
+    uint8_t* rowsCr[2] = {rowY + 3 * width, rowY + 4 * width};
+    uint8_t* outCb = rowY + 5 * width;
+    uint8_t* outCr = outCb + chroma.width;
+
+    for (size_t y = 0; y < height; ++y)
+    {
+        const size_t rowStart = y * width;
+        uint8_t* rowCb = rowsCb[y & 1];
+        uint8_t* rowCr = rowsCr[y & 1];
+
+        convertRow(r + rowStart, g + rowStart, b + rowStart, width, rowY, rowCb, rowCr);
+        storeRow(rowY, width, y, paddedWidth, planeY, applyDpcm);
+
+        switch (geometry.chroma)
+        {
+            case ChromaMode::CHROMA_444:
+                storeRow(rowCb, width, y, paddedWidth, planeCb, applyDpcm);
+                storeRow(rowCr, width, y, paddedWidth, planeCr, applyDpcm);
+                break;
+            case ChromaMode::CHROMA_422:
+                downsampleRow(rowCb, width, outCb);
+                downsampleRow(rowCr, width, outCr);
+                storeRow(outCb, chroma.width, y, chromaPaddedWidth, planeCb, applyDpcm);
+                storeRow(outCr, chroma.width, y, chromaPaddedWidth, planeCr, applyDpcm);
+                break;
+            case ChromaMode::CHROMA_420:
+                // Odd rows close a pair; an odd last row pairs with itself.
+                if (1 == (y & 1) || y + 1 == height)
+                {
+                    downsampleRows(rowsCb[0], rowCb, width, outCb);
+                    downsampleRows(rowsCr[0], rowCr, width, outCr);
+                    storeRow(outCb, chroma.width, y / 2, chromaPaddedWidth, planeCb, applyDpcm);
+                    storeRow(outCr, chroma.width, y / 2, chromaPaddedWidth, planeCr, applyDpcm);
+                }
+                break;
+        }
+    }
+
+    for (int component = 0; component < 3; ++component)
+    {
+        const PlaneGeometry plane = geometry.plane(component);
+        if (plane.paddedWidth() != plane.width || plane.paddedHeight() != plane.height)
+        {
+            replicateEdges(samples.planes[component].data(), plane);
+        }
+    }
+}
+
+} // namespace
+
+void convertFrameToBlocks(const uint8_t* rgbFrame, const FrameGeometry& geometry, BlockPlanes& samples, bool applyDpcm,
+                          std::vector<uint8_t>& rowScratch)
+{
+    dispatchPlaneGeometry<ConvertToBlocks>(geometry.plane(0), geometry, rgbFrame, samples, applyDpcm, rowScratch);
+}
+
+/// Flags the blocks of an inter frame that are close enough to their last
+/// coded version to skip, and stores the DPCM samples of every block.
+size_t selectSkippedBlocks(const BlockPlanes& current, BlockPlanes& reference, BlockPlanes& samples,
+                           unsigned threshold, uint8_t* skip)
+{
+    size_t skipped = 0;
+    for (int component = 0; component < 3; ++component)
+    {
+        for (size_t blockIndex = 0; blockIndex < current.blocksPerPlane[component]; ++blockIndex, ++skip)
+        {
+            const uint8_t* block = current.block(component, blockIndex);
+            uint8_t* last = reference.block(component, blockIndex);
+            uint8_t* stored = samples.block(component, blockIndex);
+
+            unsigned sad = 0;
+#if defined(__SSE2__)
+            __m128i sums = _mm_setzero_si128();
+            for (size_t i = 0; i < BLOCK_SIZE * BLOCK_SIZE; i += 16)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last + i));
+                sums = _mm_add_epi64(sums, _mm_sad_epu8(a, b));
+            }
+            sad = static_cast<unsigned>(_mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4));
+#else
+            for (size_t i = 0; i < BLOCK_SIZE * BLOCK_SIZE; ++i)
+            {
+                sad += static_cast<unsigned>(std::abs(block[i] - last[i]));
+            }
+#endif // __SSE2__
+
+            // A skipped block shows its last coded version again, so its DPCM
+            // samples are computed from that, the way the decoder recomputes
+            // them.
+            *skip = sad <= threshold ? 1 : 0;
+            skipped += *skip;
+            const uint8_t* source = *skip ? last : block;
+            for (size_t i = 0; i < BLOCK_SIZE * BLOCK_SIZE; ++i)
+            {
+                stored[i] = static_cast<uint8_t>(DPCM_8BIT(source[i], stored[i]));
+            }
+            if (!*skip)
+            {
+                std::memcpy(last, block, BLOCK_SIZE * BLOCK_SIZE);
+            }
+        }
+    }
+    return skipped;
+}
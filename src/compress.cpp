@@ -1,373 +1,371 @@
 #include "utils.h"
+#include "file_io.h"
 
-void compress(const std::string& inputFilePath, const std::string& outputFilePath, int quality)
+bool compress(const std::string& inputFilePath, const std::string& outputFilePath, EncoderOptions options)
 {
-    uint16_t idx = 0;
+    int quality = options.quality;
 
-    std::cout << "Processing frames..." << std::endl;
-    std::vector<std::vector<YCbCr>> yuvFrames = processFramesForCompression(inputFilePath);
-
-#ifdef DEBUG_PROCESS
-    std::ofstream processFile("/home/user/Projects/SMM/debug/yuv_frames_output.txt");
-    if (!processFile.is_open())
+    // Frames are encoded straight out of the mapping, without a copy.
+    MappedFile inputFile;
+    if (!inputFile.open(inputFilePath, true))
     {
-        std::cerr << "Failed to open file for writing YUV frames!" << std::endl;
-        return;
+        std::cerr << "Failed to open input file: " << inputFilePath << std::endl;
+        return false;
     }
 
-    for (size_t frameIndex = 0; frameIndex < yuvFrames.size(); ++frameIndex)
+    OutputWriter outputFile;
+    if (!outputFile.open(outputFilePath))
     {
-        processFile << "Frame " << frameIndex + 1 << ":\n";
-
-        for (size_t pixelIndex = 0; pixelIndex < yuvFrames[frameIndex].size(); ++pixelIndex)
-        {
-            const YCbCr& pixel = yuvFrames[frameIndex][pixelIndex];
-            processFile << "Pixel " << pixelIndex << ": Y = " << static_cast<int>(pixel.y)
-                       << ", Cb = " << static_cast<int>(pixel.cb)
-                       << ", Cr = " << static_cast<int>(pixel.cr) << "\n";
-        }
-
-        processFile << "----------------------------------------\n";
+        std::cerr << "Failed to open output file: " << outputFilePath << std::endl;
+        return false;
     }
-    
-    processFile.close();
 
-    std::cout << "Total YUV frames: " << yuvFrames.size() << std::endl;
-    for(size_t i = 0; i < yuvFrames.size(); i++)
-    {
-        std::cout << "Frame " << i << "   \thas\t" << yuvFrames[i].size() << "\tpixels" << std::endl;
-    }
-#endif // DEBUG_PROCESS
+    const FrameGeometry& geometry = options.geometry;
+    uint32_t numFrames = static_cast<uint32_t>(inputFile.size() / geometry.frameBytes());
 
-    std::cout << "Processing blocks..." << std::endl;
-    std::vector<std::vector<float>> blocks = segmentFramesToBlocks(yuvFrames);
+    StreamHeader streamHeader;
+    streamHeader.width = static_cast<uint16_t>(geometry.width);
+    streamHeader.height = static_cast<uint16_t>(geometry.height);
+    streamHeader.numFrames = numFrames;
+    streamHeader.quality = quality;
+    streamHeader.chroma = geometry.chroma;
+    streamHeader.entropy = options.entropy;
+    writeStreamHeader(outputFile, streamHeader);
 
-#ifdef DEBUG_BLOCKS
-    std::ofstream blocksFile("/home/user/Projects/SMM/debug/blocks_output.txt");
-    if (!blocksFile.is_open())
-    {
-        std::cerr << "Failed to open file for writing blocks!" << std::endl;
-        return;
-    }
+    FrameIndex index;
+    index.reserve(numFrames);
 
-    for (size_t blockIndex = 0; blockIndex < blocks.size(); ++blockIndex)
-    {
-        blocksFile << "Block " << blockIndex + 1 << ":\n";
+    options.frameBudget = rateControlBudget(options, numFrames);
 
-        for (size_t valueIndex = 0; valueIndex < blocks[blockIndex].size(); ++valueIndex)
+    if (1 < options.threads)
+    {
+        std::cout << "Encoding " << numFrames << " frames on " << options.threads << " threads..." << std::endl;
+        if (!compressGroupsParallel(inputFile.data(), outputFile, numFrames, options, index))
         {
-            blocksFile << blocks[blockIndex][valueIndex] << " ";
-
-            if ((valueIndex + 1) % 8 == 0)
-            {
-                blocksFile << "\n";
-            }
+            discardOutput(outputFile, outputFilePath);
+            return false;
+        }
+        if (options.writeIndex)
+        {
+            writeFrameIndex(outputFile, index);
+        }
+        if (!outputFile.close())
+        {
+            std::cerr << "Failed to write output file: " << outputFilePath << std::endl;
+            discardOutput(outputFile, outputFilePath);
+            return false;
         }
 
-        blocksFile << "----------------------------------------\n";
+        std::cout << "Compression completed successfully!" << std::endl
+                    << "Output file: " << outputFilePath << std::endl;
+        return true;
     }
 
-    blocksFile.close();
-#endif // DEBUG_BLOCKS
+    // Every buffer below is sized once and reused for each frame, so peak
+    // memory does not depend on the length of the input clip.
+    EncoderBuffers buffers(geometry);
+    EncodedFrame encodedFrame;
 
-    std::vector<std::array<std::array<float, 8>, 8>> quantizedBlocks;
+    std::cout << "Encoding " << numFrames << " frames..." << std::endl;
 
-    std::cout << "Aplying FDCT on blocks..." << std::endl;
-    for(const auto& block: blocks)
+    for (size_t frameIndex = 0; frameIndex < numFrames; ++frameIndex)
     {
-        float block2D[8][8];
-        vectorTo2DArray(block, block2D);
-        FDCT_2D(block2D);
-        if(0 == idx % 3)
-        {
-            // FDCT_2D Y
-            quantizeBlock(block2D, TABEL_QUANTIZARE_Y, quality);
-        }
-        else
-        {
-            // FDCT_2D CbCr
-            quantizeBlock(block2D, TABEL_QUANTIZARE_CbCr, quality);
-        }
-        std::array<std::array<float, 8>, 8> block2DArray = convertToStdArray(block2D);
-        quantizedBlocks.push_back(block2DArray);
-        idx++;
+        const uint8_t* rgbFrame = inputFile.data() + frameIndex * geometry.frameBytes();
+        encodeFrame(rgbFrame, frameIndex, options, buffers, encodedFrame);
+        writeFrameRecord(outputFile, frameIndex, numFrames, encodedFrame, index, options.stats);
     }
 
-#ifdef DEBUG_QUANTIZED_BLOCKS
-    std::ofstream quantized_blocks("/home/user/Projects/SMM/debug/quantized_blocks_output.txt");
-    if (!quantized_blocks.is_open())
+    if (options.writeIndex)
     {
-        std::cerr << "Failed to open file for writing quantized blocks!" << std::endl;
-        return;
+        writeFrameIndex(outputFile, index);
     }
-
-    for (size_t blockIndex = 0; blockIndex < quantizedBlocks.size(); ++blockIndex)
+    if (!outputFile.close())
     {
-        quantized_blocks << "Quantized Block " << blockIndex + 1 << ":\n";
-
-        for (size_t i = 0; i < 8; ++i)
-        {
-            for (size_t j = 0; j < 8; ++j)
-            {
-                quantized_blocks << quantizedBlocks[blockIndex][i][j] << " ";
-            }
-            quantized_blocks << "\n";
-        }
-
-        quantized_blocks << "----------------------------------------\n";
+        std::cerr << "Failed to write output file: " << outputFilePath << std::endl;
+        discardOutput(outputFile, outputFilePath);
+        return false;
     }
-    quantized_blocks.close();
-#endif //DEBUG_QUANTIZED_BLOCKS
 
-    std::cout << "Recomposing frame..." << std::endl;
-    std::vector<uint8_t> largeBlock = recomposeFrame(quantizedBlocks);
+    std::cout << "Compression completed successfully!" << std::endl
+                << "Output file: " << outputFilePath << std::endl;
+    return true;
+}
 
-#ifdef DEBUG_LARGE_BLOCK
-    std::ofstream lBlockFile("/home/user/Projects/SMM/debug/large_block_output.txt");
-    if (!lBlockFile.is_open())
+uint64_t rateControlBudget(const EncoderOptions& options, uint32_t numFrames)
+{
+    // The budget is spread evenly, so every frame, and every group in the
+    // parallel path, is coded the same way.
+    if (0 != options.targetBytes && 0 != numFrames)
     {
-        std::cerr << "Failed to open file for writing large block!" << std::endl;
-        return;
+        uint64_t overhead = StreamHeader::SIZE + (options.writeIndex ? frameIndexBytes(numFrames) : 0);
+        uint64_t available = options.targetBytes > overhead ? options.targetBytes - overhead : 0;
+        return std::max<uint64_t>(1, available / numFrames);
     }
-
-    for (size_t i = 0; i < largeBlock.size(); ++i)
+    if (0 != options.bitrate)
     {
-        lBlockFile << "Byte " << i << ": " << static_cast<int>(largeBlock[i]) << "\n";
+        return std::max<uint64_t>(1, options.bitrate / 8 / options.fps);
     }
+    return 0;
+}
 
-    lBlockFile.close();
-#endif //DEBUG_LARGE_BLOCK
-
-    std::cout << "Encoding..." << std::endl;
-    uint32_t numFrames = largeBlock.size() / RGB_CIF_SIZE;
-    std::vector<uint8_t> header;
-
-    std::cout << "Writting to file..." << std::endl;
-    std::ofstream outputFile(outputFilePath, std::ios::binary);
-    if (!outputFile.is_open())
+void writeFrameRecord(OutputWriter& outputFile, size_t frameIndex, uint32_t numFrames,
+                      const EncodedFrame& encodedFrame, FrameIndex& index, RunStats* stats)
+{
+    StageTimer timer(stats, Stage::WRITE);
+    const std::vector<uint8_t>& compressedData = encodedFrame.data;
+    const std::vector<uint8_t>& header = encodedFrame.header;
+    size_t payloadSize = header.size() + compressedData.size();
+
+    uint8_t frameType = encodedFrame.frameType;
+    uint64_t recordOffset = outputFile.position();
+    uint64_t nextFrameOffset = (frameIndex + 1 < numFrames) ? recordOffset + FRAME_RECORD_PREFIX + payloadSize : 0;
+    index.push_back({recordOffset, static_cast<uint32_t>(FRAME_RECORD_PREFIX + payloadSize), frameType});
+
+    outputFile.writeValue(nextFrameOffset);
+    outputFile.writeValue(frameType);
+    outputFile.writeValue(encodedFrame.quality);
+    outputFile.write(header.data(), header.size());
+    outputFile.write(compressedData.data(), compressedData.size());
+
+    if (nullptr != stats)
     {
-        std::cerr << "Failed to open output file: " << outputFilePath << std::endl;
-        return;
+        FrameStats frameStats = encodedFrame.stats;
+        frameStats.bytesOut = FRAME_RECORD_PREFIX + payloadSize;
+        stats->addFrame(frameStats);
     }
-    outputFile.write("SMP", 3);
+}
 
-    uint16_t width = CIF_X;
-    uint16_t height = CIF_Y;
-    outputFile.write(reinterpret_cast<const char*>(&width), sizeof(uint16_t));
-    outputFile.write(reinterpret_cast<const char*>(&height), sizeof(uint16_t));
-    outputFile.write(reinterpret_cast<const char*>(&numFrames), sizeof(numFrames));
-    outputFile.write(reinterpret_cast<const char*>(&quality), sizeof(quality));
+namespace
+{
 
-    uint64_t nextFrameOffset = 0;
-    uint8_t frameType = 0;
-    for (size_t frameIndex = 0; frameIndex < numFrames; ++frameIndex)
+/// Forward DCT of every block not flagged in `skip`, into the transformed
+/// buffer of the DCT mode. Quantizing is left to quantizeFrame(), so rate
+/// control can try several qualities on one transform.
+void transformFrame(EncoderBuffers& buffers, DctMode dct, const uint8_t* skip)
+{
+    const size_t totalBlocks = buffers.geometry.totalBlocks();
+    size_t firstBlock = 0;
+
+    for (int component = 0; component < 3; ++component)
     {
-        std::vector<uint8_t> currentFrame(
-            largeBlock.begin() + frameIndex * RGB_CIF_SIZE,
-            largeBlock.begin() + (frameIndex + 1) * RGB_CIF_SIZE
-        );
-        std::vector<uint8_t> compressedData = encodeHuffman(currentFrame, header);
-
-#ifdef DEBUG_HUFFMAN
-            std::ofstream headerFile("/home/user/Projects/SMM/debug/header_output.txt");
-            if (!headerFile.is_open())
+        const size_t numBlocks = buffers.samples.blocksPerPlane[component];
+        const uint8_t* skipPlane = skip ? skip + firstBlock : nullptr;
+
+        if (DctMode::INTEGER == dct)
+        {
+            // Fixed-point path: int16 from block extraction to the quantized
+            // coefficients, so the output does not depend on float handling.
+            buffers.transformedInt.resize(totalBlocks);
+            for (size_t idx = 0; idx < numBlocks; ++idx)
             {
-                std::cerr << "Failed to open file for writing header!" << std::endl;
-                return;
+                if (skipPlane && skipPlane[idx])
+                {
+                    continue;
+                }
+                CoefficientBlock& block = buffers.transformedInt[firstBlock + idx];
+                loadBlock(buffers.samples.block(component, idx), block);
+                FDCT_2D_int(block);
             }
+            firstBlock += numBlocks;
+            continue;
+        }
 
-            for (size_t i = 0; i < header.size(); ++i)
+        // Blocks go through the DCT eight at a time so the SIMD kernel can
+        // transform one block per vector lane; skipped blocks are left out.
+        buffers.transformed.resize(totalBlocks * BLOCK_SIZE * BLOCK_SIZE);
+        for (size_t next = 0; next < numBlocks;)
+        {
+            size_t indices[8];
+            size_t count = 0;
+            for (; next < numBlocks && count < 8; ++next)
             {
-                headerFile << "Byte " << i << ": " << static_cast<int>(header[i]) << "\n";
+                if (!skipPlane || !skipPlane[next])
+                {
+                    indices[count++] = next;
+                }
             }
-            headerFile.close();
 
-            std::ofstream compressedFile("/home/user/Projects/SMM/debug/compressed_data_output.txt");
-            if (!compressedFile.is_open())
+            float batch[8][8][8];
+            for (size_t k = 0; k < count; ++k)
             {
-                std::cerr << "Failed to open file for writing compressed data!" << std::endl;
-                return;
+                loadBlock(buffers.samples.block(component, indices[k]), batch[k]);
             }
 
-            for (size_t i = 0; i < compressedData.size(); ++i)
+            if (8 == count)
             {
-                compressedFile << "Byte " << i << ": " << static_cast<int>(compressedData[i]) << "\n";
+                FDCT_2D_x8(batch);
             }
-            compressedFile.close();
-
-            std::cout << "Compressed data size: " << compressedData.size() << " bytes" << std::endl;
-            std::cout << "Header size: " << header.size() << " bytes" << std::endl;
-            std::cout << "Total size: " << compressedData.size() + header.size() << " bytes" << std::endl;
-            std::cout << "Total frames: " << numFrames << std::endl;
-#endif //DEBUG_HUFFMAN
-
-        frameType = (frameIndex % 32 == 0) ? 0 : 1;
-        nextFrameOffset = (frameIndex + 1 < numFrames)
-                            ? (outputFile.tellp() + static_cast<std::streamoff>(compressedData.size() + sizeof(uint64_t) + 1))
-                            : std::streampos(0);
-
-        outputFile.write(reinterpret_cast<const char*>(&nextFrameOffset), sizeof(nextFrameOffset));
-        outputFile.write(reinterpret_cast<const char*>(&frameType), sizeof(frameType));
-        outputFile.write(reinterpret_cast<const char*>(compressedData.data()), compressedData.size());
-
-#ifdef DEBUG_HUFFMAN
-    std::cout << "Frame " << frameIndex << ": Compressed data size = " << compressedData.size() << " bytes" << std::endl;
-    std::cout << "Frame " << frameIndex << ": Next frame offset = " << nextFrameOffset << std::endl;
-#endif
-    }
-
-    outputFile.close();
-
-    std::cout << "Compression completed successfully!" << std::endl
-                << "Output file: " << outputFilePath << std::endl;
-
-}
-
-std::vector<std::vector<YCbCr>> processFramesForCompression(const std::string& inputFilePath)
-{
-    std::ifstream inputFile(inputFilePath, std::ios::binary);
-
-    std::vector<uint8_t> currentFrame(RGB_CIF_SIZE);
-    std::vector<YCbCr> currFrame(CIF_SIZE);
-    std::vector<YCbCr> prevFrame(CIF_SIZE);
-    std::vector<std::vector<YCbCr>> yuvFrames;
-    YCbCr pixels = {0, 0, 0};
-
-    if (!inputFile.is_open())
-    {
-        std::cerr << "Failed to open input file: " << inputFilePath << std::endl;
-    }
-    else
-    {
-        size_t frameIndex = 0;
-
-#ifdef DEBUG_COMPRESS
-        std::ofstream compressFile("/home/user/Projects/SMM/debug/compress.txt", std::ios::app);
-        if (!compressFile.is_open())
-        {
-            std::cerr << "Failed to open compressFile file!" << std::endl;
-        }
-#endif // DEBUG_COMPRESS
-        while (inputFile.read(reinterpret_cast<char*>(currentFrame.data()), RGB_CIF_SIZE))
-        {
-#ifdef DEBUG_COMPRESS
-            std::streamsize bytesRead = inputFile.gcount();
-            std::cout << "Bytes read for frame " << frameIndex << ": " << bytesRead << std::endl;
-#endif //DEBUG_COMPRESS
-            currFrame.clear();
-            for (size_t i = 0; i < CIF_SIZE; i++)
+            else
             {
-                RGB rgb = {currentFrame[i], currentFrame[i + CIF_SIZE], currentFrame[i + 2*CIF_SIZE]};
-                pixels = rgbToYuv(rgb);
-                if ((0 != frameIndex % 32 )  &&  (0 != frameIndex))
-                {
-                    pixels.y = DPCM_8BIT(pixels.y, prevFrame[i].y);
-                    pixels.cb = DPCM_8BIT(pixels.cb, prevFrame[i].cb);
-                    pixels.cr = DPCM_8BIT(pixels.cr, prevFrame[i].cr);
-#ifdef DEBUG_COMPRESS
-                    compressFile <<"Y: " << static_cast<int>(pixels.y) << " Cb: " << static_cast<int>(pixels.cb) << " Cr: " << static_cast<int>(pixels.cr) << std::endl;
-#endif // DEBUG_COMPRESS
-                }
-#ifdef DEBUG_COMPRESS
-                else
+                for (size_t k = 0; k < count; ++k)
                 {
-                    compressFile << frameIndex << std::endl;
-                    compressFile <<"Y: " << static_cast<int>(pixels.y) << " Cb: " << static_cast<int>(pixels.cb) << " Cr: " << static_cast<int>(pixels.cr) << std::endl;
+                    FDCT_2D(batch[k]);
                 }
-#endif // DEBUG_COMPRESS
-                currFrame.push_back(pixels);
             }
-            yuvFrames.push_back(currFrame);
-            prevFrame = currFrame;
 
-            ++frameIndex;
+            for (size_t k = 0; k < count; ++k)
+            {
+                std::memcpy(buffers.transformed.data() + (firstBlock + indices[k]) * BLOCK_SIZE * BLOCK_SIZE,
+                            batch[k], sizeof(batch[k]));
+            }
         }
-#ifdef DEBUG_COMPRESS
-        compressFile.close();
-#endif // DEBUG_COMPRESS
-        inputFile.close();
+        firstBlock += numBlocks;
     }
-    return yuvFrames;
 }
 
-std::vector<std::vector<float>> segmentFramesToBlocks(const std::vector<std::vector<YCbCr>>& yuvFrames)
+/// Quantizes the transformed blocks at `quality` into the coefficient
+/// buffer, which keeps the same block order: component plane by component
+/// plane, and the order the entropy coder reads.
+void quantizeFrame(EncoderBuffers& buffers, DctMode dct, int quality, const uint8_t* skip)
 {
-    std::vector<std::vector<float>> blocks;
-
-    for (size_t frameIndex = 0; frameIndex < yuvFrames.size(); ++frameIndex)
+    size_t blockIndex = 0;
+    for (int component = 0; component < 3; ++component)
     {
-        const auto& yuvFrame = yuvFrames[frameIndex];
+        const Quantizer& quantizer = componentQuantizer(component, quality);
+        const size_t numBlocks = buffers.samples.blocksPerPlane[component];
 
-        for (size_t y = 0; y < CIF_Y; y += BLOCK_SIZE)
+        for (size_t idx = 0; idx < numBlocks; ++idx, ++blockIndex)
         {
-            for (size_t x = 0; x < CIF_X; x += BLOCK_SIZE)
+            if (skip && skip[blockIndex])
             {
-                std::vector<float> blockY;
-                std::vector<float> blockCb;
-                std::vector<float> blockCr;
+                continue;
+            }
 
-                for (size_t i = 0; i < BLOCK_SIZE; ++i)
-                {
-                    for (size_t j = 0; j < BLOCK_SIZE; ++j)
-                    {
-                        size_t pixelIndex = (y + i) * CIF_X + (x + j);
-                        if (y + i < CIF_Y && x + j < CIF_X)
-                        {
-                            blockY.push_back(yuvFrame[pixelIndex].y);
-                            blockCb.push_back(yuvFrame[pixelIndex].cb);
-                            blockCr.push_back(yuvFrame[pixelIndex].cr);
-                        }
-                    }
-                }
-                blocks.push_back(blockY);
-                blocks.push_back(blockCb);
-                blocks.push_back(blockCr);
+            int16_t* coefficients = buffers.coefficients.data() + blockIndex * BLOCK_SIZE * BLOCK_SIZE;
+            if (DctMode::INTEGER == dct)
+            {
+                quantizer.quantize(buffers.transformedInt[blockIndex], coefficients);
+            }
+            else
+            {
+                const float* block = buffers.transformed.data() + blockIndex * BLOCK_SIZE * BLOCK_SIZE;
+                quantizer.quantize(reinterpret_cast<const float (*)[8]>(block), coefficients);
             }
         }
     }
-    return blocks;
 }
 
-void quantizeBlock(float block[8][8], const unsigned char quantTable[8][8], int quality)
+/// Payload size of the quantized frame with the given entropy coder.
+size_t payloadSize(EncoderBuffers& buffers, EntropyMode entropy, const uint8_t* skip)
 {
-    uint32_t localQuantTable[8][8];
-    if(quality < 50)
+    const int16_t* coefficients = buffers.coefficients.data();
+    return EntropyMode::RANS == entropy ? ransPayloadSize(coefficients, skip, buffers.geometry)
+                                        : encodedPayloadSize(coefficients, skip, buffers.geometry, &buffers.tables);
+}
+
+/// Highest quality up to `maxQuality` whose payload fits `budget` bytes, or
+/// 1 if none does. Each trial only requantizes and sizes the code from the
+/// symbol histograms; no bitstream is written.
+int chooseQuality(EncoderBuffers& buffers, const EncoderOptions& options, uint64_t budget, const uint8_t* skip)
+{
+    const int maxQuality = options.quality;
+    int low = 1;
+    int high = maxQuality;
+    while (low < high)
     {
-        for (int i = 0; i < 8; ++i)
+        int quality = (low + high + 1) / 2;
+        quantizeFrame(buffers, options.dct, quality, skip);
+        if (payloadSize(buffers, options.entropy, skip) <= budget)
         {
-            for (int j = 0; j < 8; ++j)
-            {
-                localQuantTable[i][j] = std::max(1, (int)(quantTable[i][j] * (5000 / quality)));
-            }
+            low = quality;
         }
-    }
-    else if (quality > 50)
-    {
-        for (int i = 0; i < 8; ++i)
+        else
         {
-            for (int j = 0; j < 8; ++j)
-            {
-                localQuantTable[i][j] = std::max(1, (int)(quantTable[i][j] * (200 - quality * 2)));
-            }
+            high = quality - 1;
         }
     }
+    return low;
+}
+
+} // namespace
+
+EncoderBuffers::EncoderBuffers(const FrameGeometry& geometry)
+    : geometry(geometry),
+      samples(geometry),
+      coefficients(geometry.totalBlocks() * BLOCK_SIZE * BLOCK_SIZE)
+{
+}
+
+void encodeFrame(const uint8_t* rgbFrame, size_t frameIndex, const EncoderOptions& options,
+                 EncoderBuffers& buffers, EncodedFrame& encodedFrame)
+{
+    const FrameGeometry& geometry = buffers.geometry;
+    const bool interFrame = 0 != frameIndex % GOP_SIZE;
+    const uint8_t* skip = nullptr;
+    encodedFrame.frameType = interFrame ? FRAME_INTER : FRAME_INTRA;
+    // Codes are only reused within a group, which has to decode on its own.
+    buffers.tables.valid = buffers.tables.valid && interFrame;
+
+    if (0 > options.skipThreshold)
+    {
+        StageTimer timer(options.stats, Stage::CONVERT);
+        processFrameForCompression(rgbFrame, frameIndex, geometry, buffers.samples, buffers.rowScratch);
+    }
     else
     {
-        for (int i = 0; i < 8; ++i)
+        StageTimer timer(options.stats, Stage::CONVERT);
+        if (buffers.skip.empty())
         {
-            for (int j = 0; j < 8; ++j)
-            {
-                localQuantTable[i][j] = quantTable[i][j];
-            }
+            buffers.reference = BlockPlanes(geometry);
+            buffers.current = BlockPlanes(geometry);
+            buffers.skip.resize(geometry.totalBlocks());
         }
-    }
 
-    for (int i = 0; i < 8; ++i) {
-        for (int j = 0; j < 8; ++j) {
-            block[i][j] = round(block[i][j] / localQuantTable[i][j]);
-            block[i][j] = std::max(8.0f, std::min(255.0f, block[i][j]));
+        if (interFrame)
+        {
+            convertFrameToBlocks(rgbFrame, geometry, buffers.current, false, buffers.rowScratch);
+            selectSkippedBlocks(buffers.current, buffers.reference, buffers.samples,
+                                static_cast<unsigned>(options.skipThreshold), buffers.skip.data());
+            skip = buffers.skip.data();
+            encodedFrame.frameType = FRAME_INTER_SKIP;
+        }
+        else
+        {
+            processFrameForCompression(rgbFrame, frameIndex, geometry, buffers.samples, buffers.rowScratch);
+            buffers.reference = buffers.samples;
         }
     }
+
+    {
+        StageTimer timer(options.stats, Stage::TRANSFORM);
+        transformFrame(buffers, options.dct, skip);
+    }
+
+    int quality = options.quality;
+    if (0 != options.frameBudget)
+    {
+        StageTimer timer(options.stats, Stage::RATE_CONTROL);
+        uint64_t payloadBudget = options.frameBudget > FRAME_RECORD_PREFIX ? options.frameBudget - FRAME_RECORD_PREFIX : 0;
+        quality = chooseQuality(buffers, options, payloadBudget, skip);
+    }
+    {
+        StageTimer timer(options.stats, Stage::QUANTIZE);
+        quantizeFrame(buffers, options.dct, quality, skip);
+    }
+    encodedFrame.quality = static_cast<uint8_t>(quality);
+
+    StageTimer timer(options.stats, Stage::ENTROPY_ENCODE);
+    encodedFrame.stats.frameType = encodedFrame.frameType;
+    if (EntropyMode::RANS == options.entropy)
+    {
+        ransEncodeCoefficients(buffers.coefficients.data(), skip, geometry, encodedFrame);
+    }
+    else
+    {
+        encodeCoefficients(buffers.coefficients.data(), skip, geometry, encodedFrame, &buffers.tables);
+    }
+    encodedFrame.stats.quality = encodedFrame.quality;
+    encodedFrame.stats.bytesIn = geometry.frameBytes();
+}
+
+void processFrameForCompression(const uint8_t* rgbFrame, size_t frameIndex, const FrameGeometry& geometry,
+                                BlockPlanes& samples, std::vector<uint8_t>& rowScratch)
+{
+    bool applyDpcm = (0 != frameIndex % GOP_SIZE )  &&  (0 != frameIndex);
+
+    // Conversion, DPCM and block extraction happen in one pass; the block
+    // buffer still holds the previous frame, which is the DPCM reference.
+    convertFrameToBlocks(rgbFrame, geometry, samples, applyDpcm, rowScratch);
 }
 
 void FDCT_2D(float block[8][8])
@@ -407,11 +405,11 @@ void FDCT_2D(float block[8][8])
         // FDCT 1D Phase 4
         p4[0] = p3[0];
         p4[1] = p3[1];
-        p4[2] = p3[2] * c4;
+        p4[2] = p3[2] * FDCT_C4;
         p4[3] = p3[3];
-        p4[4] = -( ( p3[4] + p3[6] ) * c6 + p3[4] * ( c2 - c6 ) );
-        p4[5] = p3[5] * c4;
-        p4[6] = p3[6] * ( c2 + c6 ) - ( p3[4] + p3[6] ) * c6;
+        p4[4] = -( ( p3[4] + p3[6] ) * FDCT_C6 + p3[4] * FDCT_C2_MINUS_C6 );
+        p4[5] = p3[5] * FDCT_C4;
+        p4[6] = p3[6] * FDCT_C2_PLUS_C6 - ( p3[4] + p3[6] ) * FDCT_C6;
         p4[7] = p3[7];
         // FDCT 1D Phase 5
         p5[0] = p4[0];
@@ -432,14 +430,14 @@ void FDCT_2D(float block[8][8])
         p6[6] = p5[5] - p5[6];
         p6[7] = p5[7] - p5[4];
         // FDCT 1D Phase 7
-        block[i][0] = p6[0] * 1 / ( 2 * sqrt(2) );
-        block[i][1] = p6[1] * 1 / ( 4 * c4 );
-        block[i][2] = p6[2] * 1 / ( 4 * c2 );
-        block[i][3] = p6[3] * 1 / ( 4 * c6 );
-        block[i][4] = p6[4] * 1 / ( 4 * c5 );
-        block[i][5] = p6[5] * 1 / ( 4 * c1 );
-        block[i][6] = p6[6] * 1 / ( 4 * c7 );
-        block[i][7] = p6[7] * 1 / ( 4 * c3 );
+        block[i][0] = p6[0] * FDCT_SCALE[0];
+        block[i][1] = p6[1] * FDCT_SCALE[1];
+        block[i][2] = p6[2] * FDCT_SCALE[2];
+        block[i][3] = p6[3] * FDCT_SCALE[3];
+        block[i][4] = p6[4] * FDCT_SCALE[4];
+        block[i][5] = p6[5] * FDCT_SCALE[5];
+        block[i][6] = p6[6] * FDCT_SCALE[6];
+        block[i][7] = p6[7] * FDCT_SCALE[7];
 	}
 	// then process columns
 	for (i = 0; i < 8; i++)
@@ -474,11 +472,11 @@ void FDCT_2D(float block[8][8])
         // FDCT 1D Phase 4
         p4[0] = p3[0];
         p4[1] = p3[1];
-        p4[2] = p3[2] * c4;
+        p4[2] = p3[2] * FDCT_C4;
         p4[3] = p3[3];
-        p4[4] = -( ( p3[4] + p3[6] ) * c6 + p3[4] * ( c2 - c6 ) );
-        p4[5] = p3[5] * c4;
-        p4[6] = p3[6] * ( c2 + c6 ) - ( p3[4] + p3[6] ) * c6;
+        p4[4] = -( ( p3[4] + p3[6] ) * FDCT_C6 + p3[4] * FDCT_C2_MINUS_C6 );
+        p4[5] = p3[5] * FDCT_C4;
+        p4[6] = p3[6] * FDCT_C2_PLUS_C6 - ( p3[4] + p3[6] ) * FDCT_C6;
         p4[7] = p3[7];
         // FDCT 1D Phase 5
         p5[0] = p4[0];
@@ -499,14 +497,14 @@ void FDCT_2D(float block[8][8])
         p6[6] = p5[5] - p5[6];
         p6[7] = p5[7] - p5[4];
         // FDCT 1D Phase 7
-        block[0][i] = p6[0] * 1 / ( 2 * sqrt(2) );
-        block[1][i] = p6[1] * 1 / ( 4 * c4 );
-        block[2][i] = p6[2] * 1 / ( 4 * c2 );
-        block[3][i] = p6[3] * 1 / ( 4 * c6 );
-        block[4][i] = p6[4] * 1 / ( 4 * c5 );
-        block[5][i] = p6[5] * 1 / ( 4 * c1 );
-        block[6][i] = p6[6] * 1 / ( 4 * c7 );
-        block[7][i] = p6[7] * 1 / ( 4 * c3 );
+        block[0][i] = p6[0] * FDCT_SCALE[0];
+        block[1][i] = p6[1] * FDCT_SCALE[1];
+        block[2][i] = p6[2] * FDCT_SCALE[2];
+        block[3][i] = p6[3] * FDCT_SCALE[3];
+        block[4][i] = p6[4] * FDCT_SCALE[4];
+        block[5][i] = p6[5] * FDCT_SCALE[5];
+        block[6][i] = p6[6] * FDCT_SCALE[6];
+        block[7][i] = p6[7] * FDCT_SCALE[7];
 	}
 }
 
@@ -0,0 +1,385 @@
+#include "utils.h"
+#include "file_io.h"
+#include "smp.h"
+
+bool decompress(const std::string& inputFilePath, const std::string& outputFilePath, unsigned threads, RunStats* stats)
+{
+    // Payloads are decoded in place from the mapping.
+    MappedFile inputFile;
+    if (!inputFile.open(inputFilePath, true))
+    {
+        std::cerr << "Failed to open input file: " << inputFilePath << std::endl;
+        return false;
+    }
+
+    SmpDecoder decoder;
+    if (!decoder.open(inputFile.data(), inputFile.size(), stats))
+    {
+        std::cerr << "Cannot decode " << inputFilePath << ": " << decoder.error() << std::endl;
+        return false;
+    }
+
+    OutputWriter outputFile;
+    if (!outputFile.open(outputFilePath))
+    {
+        std::cerr << "Failed to open output file: " << outputFilePath << std::endl;
+        return false;
+    }
+
+    if (1 < threads)
+    {
+        std::cout << "Decoding " << decoder.frameCount() << " frames on " << threads << " threads..." << std::endl;
+    }
+    else
+    {
+        std::cout << "Decoding " << decoder.frameCount() << " frames..." << std::endl;
+    }
+
+    bool decoded = decoder.decodeGroups(threads, [&](const uint8_t* rgbFrame, size_t size)
+    {
+        StageTimer timer(stats, Stage::WRITE);
+        outputFile.write(rgbFrame, size);
+        return outputFile.good();
+    });
+    if (!decoded)
+    {
+        std::cerr << decoder.error() << std::endl;
+        discardOutput(outputFile, outputFilePath);
+        return false;
+    }
+
+    if (!outputFile.close())
+    {
+        std::cerr << "Failed to write output file: " << outputFilePath << std::endl;
+        discardOutput(outputFile, outputFilePath);
+        return false;
+    }
+
+    std::cout << "Decompression completed successfully!" << std::endl
+                << "Output file: " << outputFilePath << std::endl;
+    return true;
+}
+
+DecoderBuffers::DecoderBuffers(const FrameGeometry& geometry)
+    : coefficients(geometry.totalBlocks() * BLOCK_SIZE * BLOCK_SIZE),
+      skip(geometry.totalBlocks())
+{
+    for (int component = 0; component < 3; ++component)
+    {
+        size_t samples = geometry.plane(component).samples();
+        planes[component].resize(samples);
+        prevPlanes[component].resize(samples);
+        pixels[component].resize(samples);
+    }
+}
+
+namespace
+{
+
+/// Dequantizes and inverse transforms the blocks of one component plane
+/// into a raster plane, dropping the padding past the plane edges. Blocks
+/// flagged in `skip`, if given, are left alone. Width and Height are
+/// compile-time plane sizes, or 0 for the runtime geometry.
+template <size_t Width, size_t Height>
+struct ReconstructPlane
+{
+    static void run(const PlaneGeometry& geometry, const int16_t* coefficients, const uint8_t* skip,
+                    const Quantizer& quantizer, uint8_t* plane)
+    {
+        const size_t width = Width ? Width : geometry.width;
+        const size_t height = Height ? Height : geometry.height;
+        const size_t blocksPerRow = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        const size_t blocksPerPlane = blocksPerRow * ((height + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+        for (size_t blockIndex = 0; blockIndex < blocksPerPlane; ++blockIndex)
+        {
+            size_t x = (blockIndex % blocksPerRow) * BLOCK_SIZE;
+            size_t y = (blockIndex / blocksPerRow) * BLOCK_SIZE;
+
+            const int16_t* blockCoefficients = coefficients;
+            coefficients += BLOCK_SIZE * BLOCK_SIZE;
+            if (skip && skip[blockIndex])
+            {
+                continue;
+            }
+
+            float block[8][8];
+            quantizer.dequantize(blockCoefficients, block);
+
+            IDCT_2D(block);
+
+            const size_t rows = std::min<size_t>(BLOCK_SIZE, height - y);
+            const size_t columns = std::min<size_t>(BLOCK_SIZE, width - x);
+            for (size_t i = 0; i < rows; ++i)
+            {
+                uint8_t* row = plane + (y + i) * width + x;
+                for (size_t j = 0; j < columns; ++j)
+                {
+                    // Clamped first, rounding half up matches LIMIT(round())
+                    // without a libm call per sample.
+                    float value = std::min(std::max(block[i][j] + 128.0f, 0.0f), 255.0f);
+                    row[j] = static_cast<uint8_t>(value + 0.5f);
+                }
+            }
+        }
+    }
+};
+
+/// Inverse DPCM of a FRAME_INTER_SKIP plane. A skipped block keeps the
+/// previous frame's pixels, and its stored samples are recomputed from them
+/// so they can serve as the next frame's reference.
+void inverseDpcmWithSkip(const PlaneGeometry& geometry, const uint8_t* skip, const uint8_t* prev,
+                         uint8_t* stored, uint8_t* pixels)
+{
+    const size_t blocksPerRow = geometry.blocksPerRow();
+    for (size_t y = 0; y < geometry.height; ++y)
+    {
+        const uint8_t* rowSkip = skip + (y / BLOCK_SIZE) * blocksPerRow;
+        for (size_t x = 0; x < geometry.width; ++x)
+        {
+            size_t i = y * geometry.width + x;
+            if (rowSkip[x / BLOCK_SIZE])
+            {
+                stored[i] = static_cast<uint8_t>(DPCM_8BIT(pixels[i], prev[i]));
+            }
+            else
+            {
+                pixels[i] = IDPCM_8BIT(stored[i], prev[i]);
+            }
+        }
+    }
+}
+
+} // namespace
+
+bool decodeFrame(const uint8_t* payload, size_t size, uint8_t frameType, int quality, const FrameGeometry& geometry,
+                 DecoderBuffers& buffers, uint8_t* rgbFrame, RunStats* stats)
+{
+    const uint8_t tableFlags = frameType & ~FRAME_TYPE_MASK;
+    frameType &= FRAME_TYPE_MASK;
+    if (FRAME_INTER_SKIP < frameType || 1 > quality || 100 < quality
+        || 0 != (tableFlags & ~(FRAME_REUSE_DC_TABLE | FRAME_REUSE_AC_TABLE))
+        || ((FRAME_INTRA == frameType || EntropyMode::RANS == buffers.entropy) && 0 != tableFlags))
+    {
+        return false;
+    }
+
+    uint8_t* skip = FRAME_INTER_SKIP == frameType ? buffers.skip.data() : nullptr;
+    {
+        StageTimer timer(stats, Stage::ENTROPY_DECODE);
+        bool decoded = EntropyMode::RANS == buffers.entropy
+                           ? ransDecodeCoefficients(payload, size, geometry, skip, buffers.ransTables,
+                                                    buffers.coefficients.data())
+                           : decodeCoefficients(payload, size, geometry, skip, buffers.dcTable, buffers.acTable,
+                                                buffers.coefficients.data(), tableFlags);
+        if (!decoded)
+        {
+            return false;
+        }
+    }
+
+    // Blocks come one component plane at a time, in raster order.
+    {
+        StageTimer timer(stats, Stage::RECONSTRUCT);
+        const int16_t* coefficients = buffers.coefficients.data();
+        for (int component = 0; component < 3; ++component)
+        {
+            const PlaneGeometry plane = geometry.plane(component);
+            dispatchPlaneGeometry<ReconstructPlane>(plane, coefficients, skip, componentQuantizer(component, quality),
+                                                    buffers.planes[component].data());
+            coefficients += plane.blocks() * BLOCK_SIZE * BLOCK_SIZE;
+
+            // The encoder's DPCM reference is the previous frame's stored
+            // samples, not its reconstruction.
+            std::vector<uint8_t>& stored = buffers.planes[component];
+            std::vector<uint8_t>& pixels = buffers.pixels[component];
+            if (skip)
+            {
+                inverseDpcmWithSkip(plane, skip, buffers.prevPlanes[component].data(), stored.data(), pixels.data());
+                skip += plane.blocks();
+            }
+            else if (FRAME_INTRA != frameType)
+            {
+                const std::vector<uint8_t>& prev = buffers.prevPlanes[component];
+                for (size_t i = 0; i < stored.size(); ++i)
+                {
+                    pixels[i] = IDPCM_8BIT(stored[i], prev[i]);
+                }
+            }
+            else
+            {
+                pixels = stored;
+            }
+            std::swap(buffers.planes[component], buffers.prevPlanes[component]);
+        }
+    }
+
+    // Subsampled chroma is upsampled by repeating each sample.
+    StageTimer timer(stats, Stage::COLOR_OUTPUT);
+    const PlaneGeometry chroma = geometry.plane(1);
+    const size_t shiftX = chroma.width == geometry.width ? 0 : 1;
+    const size_t shiftY = chroma.height == geometry.height ? 0 : 1;
+    const size_t pixelCount = geometry.pixels();
+
+    for (size_t y = 0; y < geometry.height; ++y)
+    {
+        const uint8_t* rowY = buffers.pixels[0].data() + y * geometry.width;
+        const uint8_t* rowCb = buffers.pixels[1].data() + (y >> shiftY) * chroma.width;
+        const uint8_t* rowCr = buffers.pixels[2].data() + (y >> shiftY) * chroma.width;
+        uint8_t* out = rgbFrame + y * geometry.width;
+
+        for (size_t x = 0; x < geometry.width; ++x)
+        {
+            const int luma = rowY[x];
+            const int cb = rowCb[x >> shiftX];
+            const int cr = rowCr[x >> shiftX];
+            out[x] = static_cast<uint8_t>(FIX_YUV2R(luma, cb, cr));
+            out[x + pixelCount] = static_cast<uint8_t>(FIX_YUV2G(luma, cb, cr));
+            out[x + 2 * pixelCount] = static_cast<uint8_t>(FIX_YUV2B(luma, cb, cr));
+        }
+    }
+
+    return true;
+}
+
+/// Inverse of FDCT_2D: runs the seven butterfly phases backwards, so the
+/// input is expected in the same permuted coefficient order.
+void IDCT_2D(float block[8][8])
+{
+	float p1[8], p2[8], p3[8], p4[8], p5[8], p6[8];
+	size_t i;
+
+	for (i = 0; i < 8; i++)
+    {
+        // IDCT 1D Phase 7
+        p6[0] = block[0][i] * IDCT_SCALE[0];
+        p6[1] = block[1][i] * IDCT_SCALE[1];
+        p6[2] = block[2][i] * IDCT_SCALE[2];
+        p6[3] = block[3][i] * IDCT_SCALE[3];
+        p6[4] = block[4][i] * IDCT_SCALE[4];
+        p6[5] = block[5][i] * IDCT_SCALE[5];
+        p6[6] = block[6][i] * IDCT_SCALE[6];
+        p6[7] = block[7][i] * IDCT_SCALE[7];
+        // IDCT 1D Phase 6
+        p5[0] = p6[0];
+        p5[1] = p6[1];
+        p5[2] = p6[2];
+        p5[3] = p6[3];
+        p5[4] = ( p6[4] - p6[7] ) * 0.5f;
+        p5[5] = ( p6[5] + p6[6] ) * 0.5f;
+        p5[6] = ( p6[5] - p6[6] ) * 0.5f;
+        p5[7] = ( p6[4] + p6[7] ) * 0.5f;
+        // IDCT 1D Phase 5
+        p4[0] = p5[0];
+        p4[1] = p5[1];
+        p4[2] = ( p5[2] - p5[3] ) * 0.5f;
+        p4[3] = ( p5[2] + p5[3] ) * 0.5f;
+        p4[4] = p5[4];
+        p4[5] = ( p5[5] - p5[7] ) * 0.5f;
+        p4[6] = p5[6];
+        p4[7] = ( p5[5] + p5[7] ) * 0.5f;
+        // IDCT 1D Phase 4
+        p3[0] = p4[0];
+        p3[1] = p4[1];
+        p3[2] = p4[2] * IDCT_INV_C4;
+        p3[3] = p4[3];
+        p3[4] = -p4[4] * IDCT_C2 - p4[6] * IDCT_C6;
+        p3[5] = p4[5] * IDCT_INV_C4;
+        p3[6] = -p4[4] * IDCT_C6 + p4[6] * IDCT_C2;
+        p3[7] = p4[7];
+        // IDCT 1D Phase 3
+        p2[0] = ( p3[0] + p3[1] ) * 0.5f;
+        p2[1] = ( p3[0] - p3[1] ) * 0.5f;
+        p2[2] = p3[2] - p3[3];
+        p2[3] = p3[3];
+        p2[4] = p3[4];
+        p2[5] = p3[5];
+        p2[6] = p3[6];
+        p2[7] = p3[7];
+        // IDCT 1D Phase 2
+        p1[0] = ( p2[0] + p2[3] ) * 0.5f;
+        p1[1] = ( p2[1] + p2[2] ) * 0.5f;
+        p1[2] = ( p2[1] - p2[2] ) * 0.5f;
+        p1[3] = ( p2[0] - p2[3] ) * 0.5f;
+        p1[7] = p2[7];
+        p1[6] = p2[6] - p1[7];
+        p1[5] = p2[5] - p1[6];
+        p1[4] = -p2[4] - p1[5];
+        // IDCT 1D Phase 1
+        block[0][i] = ( p1[0] + p1[7] ) * 0.5f;
+        block[1][i] = ( p1[1] + p1[6] ) * 0.5f;
+        block[2][i] = ( p1[2] + p1[5] ) * 0.5f;
+        block[3][i] = ( p1[3] + p1[4] ) * 0.5f;
+        block[4][i] = ( p1[3] - p1[4] ) * 0.5f;
+        block[5][i] = ( p1[2] - p1[5] ) * 0.5f;
+        block[6][i] = ( p1[1] - p1[6] ) * 0.5f;
+        block[7][i] = ( p1[0] - p1[7] ) * 0.5f;
+	}
+	// then process rows
+	for (i = 0; i < 8; i++)
+    {
+        // IDCT 1D Phase 7
+        p6[0] = block[i][0] * IDCT_SCALE[0];
+        p6[1] = block[i][1] * IDCT_SCALE[1];
+        p6[2] = block[i][2] * IDCT_SCALE[2];
+        p6[3] = block[i][3] * IDCT_SCALE[3];
+        p6[4] = block[i][4] * IDCT_SCALE[4];
+        p6[5] = block[i][5] * IDCT_SCALE[5];
+        p6[6] = block[i][6] * IDCT_SCALE[6];
+        p6[7] = block[i][7] * IDCT_SCALE[7];
+        // IDCT 1D Phase 6
+        p5[0] = p6[0];
+        p5[1] = p6[1];
+        p5[2] = p6[2];
+        p5[3] = p6[3];
+        p5[4] = ( p6[4] - p6[7] ) * 0.5f;
+        p5[5] = ( p6[5] + p6[6] ) * 0.5f;
+        p5[6] = ( p6[5] - p6[6] ) * 0.5f;
+        p5[7] = ( p6[4] + p6[7] ) * 0.5f;
+        // IDCT 1D Phase 5
+        p4[0] = p5[0];
+        p4[1] = p5[1];
+        p4[2] = ( p5[2] - p5[3] ) * 0.5f;
+        p4[3] = ( p5[2] + p5[3] ) * 0.5f;
+        p4[4] = p5[4];
+        p4[5] = ( p5[5] - p5[7] ) * 0.5f;
+        p4[6] = p5[6];
+        p4[7] = ( p5[5] + p5[7] ) * 0.5f;
+        // IDCT 1D Phase 4
+        p3[0] = p4[0];
+        p3[1] = p4[1];
+        p3[2] = p4[2] * IDCT_INV_C4;
+        p3[3] = p4[3];
+        p3[4] = -p4[4] * IDCT_C2 - p4[6] * IDCT_C6;
+        p3[5] = p4[5] * IDCT_INV_C4;
+        p3[6] = -p4[4] * IDCT_C6 + p4[6] * IDCT_C2;
+        p3[7] = p4[7];
+        // IDCT 1D Phase 3
+        p2[0] = ( p3[0] + p3[1] ) * 0.5f;
+        p2[1] = ( p3[0] - p3[1] ) * 0.5f;
+        p2[2] = p3[2] - p3[3];
+        p2[3] = p3[3];
+        p2[4] = p3[4];
+        p2[5] = p3[5];
+        p2[6] = p3[6];
+        p2[7] = p3[7];
+        // IDCT 1D Phase 2
+        p1[0] = ( p2[0] + p2[3] ) * 0.5f;
+        p1[1] = ( p2[1] + p2[2] ) * 0.5f;
+        p1[2] = ( p2[1] - p2[2] ) * 0.5f;
+        p1[3] = ( p2[0] - p2[3] ) * 0.5f;
+        p1[7] = p2[7];
+        p1[6] = p2[6] - p1[7];
+        p1[5] = p2[5] - p1[6];
+        p1[4] = -p2[4] - p1[5];
+        // IDCT 1D Phase 1
+        block[i][0] = ( p1[0] + p1[7] ) * 0.5f;
+        block[i][1] = ( p1[1] + p1[6] ) * 0.5f;
+        block[i][2] = ( p1[2] + p1[5] ) * 0.5f;
+        block[i][3] = ( p1[3] + p1[4] ) * 0.5f;
+        block[i][4] = ( p1[3] - p1[4] ) * 0.5f;
+        block[i][5] = ( p1[2] - p1[5] ) * 0.5f;
+        block[i][6] = ( p1[1] - p1[6] ) * 0.5f;
+        block[i][7] = ( p1[0] - p1[7] ) * 0.5f;
+	}
+}
@@ -0,0 +1,255 @@
+#include "utils.h"
+#include "bitstream.h"
+#include "coefficient_scan.h"
+
+namespace
+{
+
+using namespace coefficient_scan;
+
+inline bool decodeSymbol(BitReader& reader, const HuffmanDecodeTable& table, uint16_t& symbol)
+{
+    const unsigned overflowBits = HuffmanDecodeTable::MAX_BITS - HuffmanDecodeTable::PRIMARY_BITS;
+
+    uint32_t bits = reader.peek(HuffmanDecodeTable::MAX_BITS);
+    HuffmanDecodeTable::Entry entry = table.primary[bits >> overflowBits];
+    if (0 == entry.length)
+    {
+        entry = table.overflow[entry.value + (bits & ((1u << overflowBits) - 1))];
+    }
+    if (HuffmanDecodeTable::INVALID_LENGTH == entry.length)
+    {
+        return false;
+    }
+    symbol = entry.value;
+    reader.skip(entry.length);
+    return true;
+}
+
+/// Symbols for parseCoefficients() from a Huffman-coded bitstream. One
+/// refill leaves at least 56 bits, enough for a 15-bit code and its
+/// magnitude bits.
+struct HuffmanSymbolSource
+{
+    BitReader& reader;
+    const HuffmanDecodeTable* tables[2];
+
+    inline bool symbol(unsigned table, uint16_t& symbol)
+    {
+        reader.refill();
+        return decodeSymbol(reader, *tables[table], symbol);
+    }
+
+    inline int magnitude(unsigned size)
+    {
+        return readMagnitude(reader, size);
+    }
+};
+
+/// Flag of the frame type byte that marks `table` as reused.
+inline uint8_t reuseFlag(unsigned table)
+{
+    return DC_TABLE == table ? FRAME_REUSE_DC_TABLE : FRAME_REUSE_AC_TABLE;
+}
+
+/// Bits of the symbols of `frequencies` coded with `codes`, or SIZE_MAX if
+/// one of them has no code.
+size_t reuseSizeBits(const HuffmanHistogram& frequencies, const HuffmanCodeTable& codes)
+{
+    size_t totalBits = 0;
+    for (size_t symbol = 0; symbol < frequencies.size(); ++symbol)
+    {
+        if (0 != frequencies[symbol] && 0 == codes[symbol].length)
+        {
+            return SIZE_MAX;
+        }
+        totalBits += frequencies[symbol] * codes[symbol].length;
+    }
+    return totalBits;
+}
+
+/// Entropy of the symbols in bits, which no prefix code can beat.
+double entropyBits(const HuffmanHistogram& frequencies)
+{
+    double total = 0.0;
+    for (size_t frequency : frequencies)
+    {
+        total += static_cast<double>(frequency);
+    }
+
+    double bits = 0.0;
+    for (size_t frequency : frequencies)
+    {
+        if (0 != frequency)
+        {
+            bits += static_cast<double>(frequency) * std::log2(total / static_cast<double>(frequency));
+        }
+    }
+    return bits;
+}
+
+/// Gathers the symbol statistics of a frame and picks its DC and AC codes.
+/// A code of `previous` is reused, and its flag set in `flags`, when it
+/// costs no more than a new code plus the header that would carry it; new
+/// codes get canonical bits. Returns the size of the bitstream in bits.
+size_t buildCodes(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                  const HuffmanTables* previous, HuffmanCodeTable codes[2], uint8_t& flags)
+{
+    HuffmanHistogram frequencies[2] = {};
+    size_t totalBits = 0;
+    scanCoefficients(coefficients, skip, geometry, [&](unsigned table, uint8_t symbol, uint32_t, unsigned size)
+    {
+        frequencies[table][symbol]++;
+        totalBits += size;
+    });
+
+    const size_t headerBits = 8 * HUFFMAN_HEADER_SIZE;
+    flags = 0;
+    for (unsigned table = 0; table < 2; ++table)
+    {
+        size_t reuseBits = (previous && previous->valid) ? reuseSizeBits(frequencies[table], previous->codes[table])
+                                                         : SIZE_MAX;
+
+        // No new code can beat the entropy, so a table that is within a
+        // header of it is reused without building one. The one-bit margin
+        // keeps rounding from ever deciding differently than the exact
+        // comparison below would.
+        bool reuse = SIZE_MAX != reuseBits
+                     && static_cast<double>(reuseBits) + 1.0 <= entropyBits(frequencies[table]) + headerBits;
+        if (!reuse)
+        {
+            buildCodeLengths(frequencies[table], HUFFMAN_MAX_CODE_LENGTH, codes[table]);
+            size_t newBits = encodedSizeBits(frequencies[table], codes[table]);
+            reuse = SIZE_MAX != reuseBits && reuseBits <= newBits + headerBits;
+            if (!reuse)
+            {
+                assignCanonicalCodes(codes[table]);
+                totalBits += newBits;
+            }
+        }
+        if (reuse)
+        {
+            codes[table] = previous->codes[table];
+            flags |= reuseFlag(table);
+            totalBits += reuseBits;
+        }
+    }
+    return totalBits;
+}
+
+/// Bytes of the code-length headers a frame with these flags carries.
+inline size_t tableHeaderBytes(uint8_t flags)
+{
+    return (flags & FRAME_REUSE_DC_TABLE ? 0 : HUFFMAN_HEADER_SIZE)
+         + (flags & FRAME_REUSE_AC_TABLE ? 0 : HUFFMAN_HEADER_SIZE);
+}
+
+} // namespace
+
+size_t encodedPayloadSize(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                          const HuffmanTables* previous)
+{
+    // The code lengths give the exact size without writing the bitstream.
+    HuffmanCodeTable codes[2];
+    uint8_t flags;
+    size_t totalBits = buildCodes(coefficients, skip, geometry, previous, codes, flags);
+    return (skip ? skipFlagBytes(geometry) : 0) + tableHeaderBytes(flags) + (totalBits + 7) / 8;
+}
+
+void encodeCoefficients(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                        EncodedFrame& encodedFrame, HuffmanTables* tables)
+{
+    // First pass: symbol statistics for the two codes.
+    HuffmanCodeTable codes[2];
+    uint8_t flags;
+    size_t totalBits = buildCodes(coefficients, skip, geometry, tables, codes, flags);
+
+    // Only the lengths of new codes go into the headers, so the decoder
+    // rebuilds the canonical codes for them.
+    const size_t skipBytes = skip ? skipFlagBytes(geometry) : 0;
+    std::vector<uint8_t>& header = encodedFrame.header;
+    header.assign(skipBytes + tableHeaderBytes(flags), 0);
+    if (skip)
+    {
+        packSkipFlags(skip, geometry, header.data());
+    }
+    size_t headerOffset = skipBytes;
+    for (unsigned table = 0; table < 2; ++table)
+    {
+        if (0 == (flags & reuseFlag(table)))
+        {
+            writeCodeLengths(codes[table], header.data() + headerOffset);
+            headerOffset += HUFFMAN_HEADER_SIZE;
+        }
+    }
+    encodedFrame.frameType |= flags;
+
+    // Second pass: each code is followed by its magnitude bits. The writer
+    // stores whole 32-bit words, so leave room for the last partial one.
+    std::vector<uint8_t>& data = encodedFrame.data;
+    data.resize((totalBits + 7) / 8 + sizeof(uint32_t));
+    BitWriter writer(data.data());
+    FrameStats& stats = encodedFrame.stats;
+    stats.codedBlocks = 0;
+    stats.symbols = 0;
+    stats.codeBits = 0;
+    scanCoefficients(coefficients, skip, geometry, [&](unsigned table, uint8_t symbol, uint32_t bits, unsigned size)
+    {
+        const HuffmanCode& code = codes[table][symbol];
+        writer.put((code.bits << size) | bits, code.length + size);
+        stats.codedBlocks += (DC_TABLE == table);
+        stats.symbols++;
+        stats.codeBits += code.length;
+    });
+    data.resize(writer.flush());
+
+    stats.dcCodes = static_cast<uint16_t>(std::count_if(codes[DC_TABLE].begin(), codes[DC_TABLE].end(),
+                                                        [](const HuffmanCode& code) { return 0 != code.length; }));
+    stats.acCodes = static_cast<uint16_t>(std::count_if(codes[AC_TABLE].begin(), codes[AC_TABLE].end(),
+                                                        [](const HuffmanCode& code) { return 0 != code.length; }));
+    stats.reusedTables = static_cast<uint8_t>(!!(flags & FRAME_REUSE_DC_TABLE) + !!(flags & FRAME_REUSE_AC_TABLE));
+
+    // The decoder only builds the tables of frames with coded blocks, so
+    // only those replace the codes later frames may reuse.
+    if (tables && 0 != stats.codedBlocks)
+    {
+        tables->codes[DC_TABLE] = codes[DC_TABLE];
+        tables->codes[AC_TABLE] = codes[AC_TABLE];
+        tables->valid = true;
+    }
+}
+
+bool decodeCoefficients(const uint8_t* payload, size_t size, const FrameGeometry& geometry, uint8_t* skip,
+                        HuffmanDecodeTable& dcTable, HuffmanDecodeTable& acTable, int16_t* coefficients,
+                        uint8_t tableFlags)
+{
+    const bool reuseDc = 0 != (tableFlags & FRAME_REUSE_DC_TABLE);
+    const bool reuseAc = 0 != (tableFlags & FRAME_REUSE_AC_TABLE);
+    const size_t skipBytes = skip ? skipFlagBytes(geometry) : 0;
+    const size_t headerBytes = tableHeaderBytes(tableFlags);
+    if (skipBytes + headerBytes > size || (reuseDc && !dcTable.valid) || (reuseAc && !acTable.valid))
+    {
+        return false;
+    }
+    size_t codedBlocks = skip ? unpackSkipFlags(payload, geometry, skip) : geometry.totalBlocks();
+    payload += skipBytes;
+    size -= skipBytes;
+
+    // A frame whose blocks are all skipped has empty codes; reused tables
+    // are still built from an earlier frame of the group.
+    if (0 != codedBlocks
+        && ((!reuseDc && !dcTable.build(payload))
+            || (!reuseAc && !acTable.build(payload + (reuseDc ? 0 : HUFFMAN_HEADER_SIZE)))))
+    {
+        return false;
+    }
+
+    BitReader reader(payload + headerBytes, size - headerBytes);
+    HuffmanSymbolSource source{reader, {&dcTable, &acTable}};
+    if (!parseCoefficients(geometry, skip, coefficients, source))
+    {
+        return false;
+    }
+
+    return !reader.overrun();
+}
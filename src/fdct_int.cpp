@@ -0,0 +1,238 @@
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FDCT_INT_HAVE_AVX2_KERNEL 1
+#endif
+
+namespace
+{
+
+// Constants are Q13 fixed point. Samples are pre-scaled by 2^PASS1_BITS for
+// the row pass so rounding in the butterflies stays below the final
+// rounding step; the column pass removes that scale again.
+constexpr int CONST_BITS = 13;
+constexpr int PASS1_BITS = 4;
+
+constexpr int32_t fix(double x)
+{
+    return static_cast<int32_t>(x * (1 << CONST_BITS) + 0.5);
+}
+
+constexpr int32_t FIX_C4 = fix(c4);
+constexpr int32_t FIX_C6 = fix(c6);
+constexpr int32_t FIX_C2_MINUS_C6 = fix(c2 - c6);
+constexpr int32_t FIX_C2_PLUS_C6 = fix(c2 + c6);
+constexpr int32_t FIX_SCALE[8] =
+{
+    fix(1 / ( 2 * M_SQRT2 )), fix(1 / ( 4 * c4 )), fix(1 / ( 4 * c2 )), fix(1 / ( 4 * c6 )),
+    fix(1 / ( 4 * c5 )),      fix(1 / ( 4 * c1 )), fix(1 / ( 4 * c7 )), fix(1 / ( 4 * c3 ))
+};
+
+inline int32_t descale(int32_t x, int bits)
+{
+    return (x + (1 << (bits - 1))) >> bits;
+}
+
+inline int32_t fixMul(int32_t x, int32_t k)
+{
+    return descale(x * k, CONST_BITS);
+}
+
+/// One 1D pass of the same seven-phase butterfly as FDCT_2D, on x[k * stride].
+inline void fdct1DInt(int32_t* x, size_t stride)
+{
+    int32_t p1[8], p2[8], p4[8], p5[8];
+
+    // Phase 1
+    p1[0] = x[0 * stride] + x[7 * stride];
+    p1[1] = x[1 * stride] + x[6 * stride];
+    p1[2] = x[2 * stride] + x[5 * stride];
+    p1[3] = x[3 * stride] + x[4 * stride];
+    p1[4] = x[3 * stride] - x[4 * stride];
+    p1[5] = x[2 * stride] - x[5 * stride];
+    p1[6] = x[1 * stride] - x[6 * stride];
+    p1[7] = x[0 * stride] - x[7 * stride];
+    // Phase 2
+    p2[0] = p1[0] + p1[3];
+    p2[1] = p1[1] + p1[2];
+    p2[2] = p1[1] - p1[2];
+    p2[3] = p1[0] - p1[3];
+    p2[4] = -( p1[4] + p1[5] );
+    p2[5] = p1[5] + p1[6];
+    p2[6] = p1[6] + p1[7];
+    p2[7] = p1[7];
+    // Phase 3 and 4
+    int32_t sum46 = p2[4] + p2[6];
+    p4[0] = p2[0] + p2[1];
+    p4[1] = p2[0] - p2[1];
+    p4[2] = fixMul(p2[2] + p2[3], FIX_C4);
+    p4[4] = -( fixMul(sum46, FIX_C6) + fixMul(p2[4], FIX_C2_MINUS_C6) );
+    p4[5] = fixMul(p2[5], FIX_C4);
+    p4[6] = fixMul(p2[6], FIX_C2_PLUS_C6) - fixMul(sum46, FIX_C6);
+    // Phase 5
+    p5[2] = p4[2] + p2[3];
+    p5[3] = p2[3] - p4[2];
+    p5[5] = p4[5] + p2[7];
+    p5[7] = p2[7] - p4[5];
+    // Phase 6 and 7
+    x[0 * stride] = fixMul(p4[0], FIX_SCALE[0]);
+    x[1 * stride] = fixMul(p4[1], FIX_SCALE[1]);
+    x[2 * stride] = fixMul(p5[2], FIX_SCALE[2]);
+    x[3 * stride] = fixMul(p5[3], FIX_SCALE[3]);
+    x[4 * stride] = fixMul(p4[4] + p5[7], FIX_SCALE[4]);
+    x[5 * stride] = fixMul(p5[5] + p4[6], FIX_SCALE[5]);
+    x[6 * stride] = fixMul(p5[5] - p4[6], FIX_SCALE[6]);
+    x[7 * stride] = fixMul(p5[7] - p4[4], FIX_SCALE[7]);
+}
+
+#ifdef FDCT_INT_HAVE_AVX2_KERNEL
+__attribute__((target("avx2")))
+inline __m256i fixMul(__m256i x, int32_t k)
+{
+    const __m256i half = _mm256_set1_epi32(1 << (CONST_BITS - 1));
+    return _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, _mm256_set1_epi32(k)), half), CONST_BITS);
+}
+
+/// fdct1DInt over eight lanes, x[k] holding sample k of eight vectors. The
+/// lanes stay int32: the pre-scaled intermediates do not fit in int16, and
+/// the same operations in the same order keep results bit-exact.
+__attribute__((target("avx2")))
+inline void fdct1DInt(__m256i x[8])
+{
+    // Phase 1
+    __m256i p1_0 = _mm256_add_epi32(x[0], x[7]);
+    __m256i p1_1 = _mm256_add_epi32(x[1], x[6]);
+    __m256i p1_2 = _mm256_add_epi32(x[2], x[5]);
+    __m256i p1_3 = _mm256_add_epi32(x[3], x[4]);
+    __m256i p1_4 = _mm256_sub_epi32(x[3], x[4]);
+    __m256i p1_5 = _mm256_sub_epi32(x[2], x[5]);
+    __m256i p1_6 = _mm256_sub_epi32(x[1], x[6]);
+    __m256i p1_7 = _mm256_sub_epi32(x[0], x[7]);
+    // Phase 2
+    __m256i p2_0 = _mm256_add_epi32(p1_0, p1_3);
+    __m256i p2_1 = _mm256_add_epi32(p1_1, p1_2);
+    __m256i p2_2 = _mm256_sub_epi32(p1_1, p1_2);
+    __m256i p2_3 = _mm256_sub_epi32(p1_0, p1_3);
+    __m256i p2_4 = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_add_epi32(p1_4, p1_5));
+    __m256i p2_5 = _mm256_add_epi32(p1_5, p1_6);
+    __m256i p2_6 = _mm256_add_epi32(p1_6, p1_7);
+    __m256i p2_7 = p1_7;
+    // Phase 3 and 4
+    __m256i sum46 = _mm256_add_epi32(p2_4, p2_6);
+    __m256i p4_0 = _mm256_add_epi32(p2_0, p2_1);
+    __m256i p4_1 = _mm256_sub_epi32(p2_0, p2_1);
+    __m256i p4_2 = fixMul(_mm256_add_epi32(p2_2, p2_3), FIX_C4);
+    __m256i p4_4 = _mm256_sub_epi32(_mm256_setzero_si256(),
+                                    _mm256_add_epi32(fixMul(sum46, FIX_C6), fixMul(p2_4, FIX_C2_MINUS_C6)));
+    __m256i p4_5 = fixMul(p2_5, FIX_C4);
+    __m256i p4_6 = _mm256_sub_epi32(fixMul(p2_6, FIX_C2_PLUS_C6), fixMul(sum46, FIX_C6));
+    // Phase 5
+    __m256i p5_2 = _mm256_add_epi32(p4_2, p2_3);
+    __m256i p5_3 = _mm256_sub_epi32(p2_3, p4_2);
+    __m256i p5_5 = _mm256_add_epi32(p4_5, p2_7);
+    __m256i p5_7 = _mm256_sub_epi32(p2_7, p4_5);
+    // Phase 6 and 7
+    x[0] = fixMul(p4_0, FIX_SCALE[0]);
+    x[1] = fixMul(p4_1, FIX_SCALE[1]);
+    x[2] = fixMul(p5_2, FIX_SCALE[2]);
+    x[3] = fixMul(p5_3, FIX_SCALE[3]);
+    x[4] = fixMul(_mm256_add_epi32(p4_4, p5_7), FIX_SCALE[4]);
+    x[5] = fixMul(_mm256_add_epi32(p5_5, p4_6), FIX_SCALE[5]);
+    x[6] = fixMul(_mm256_sub_epi32(p5_5, p4_6), FIX_SCALE[6]);
+    x[7] = fixMul(_mm256_sub_epi32(p5_7, p4_4), FIX_SCALE[7]);
+}
+
+/// Transposes the 8x8 int32 matrix held in rows r[0..7].
+__attribute__((target("avx2")))
+inline void transpose8x8(__m256i r[8])
+{
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+    __m256i s0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i s1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i s2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i s3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i s4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i s5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i s6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i s7 = _mm256_unpackhi_epi64(t5, t7);
+
+    r[0] = _mm256_permute2x128_si256(s0, s4, 0x20);
+    r[1] = _mm256_permute2x128_si256(s1, s5, 0x20);
+    r[2] = _mm256_permute2x128_si256(s2, s6, 0x20);
+    r[3] = _mm256_permute2x128_si256(s3, s7, 0x20);
+    r[4] = _mm256_permute2x128_si256(s0, s4, 0x31);
+    r[5] = _mm256_permute2x128_si256(s1, s5, 0x31);
+    r[6] = _mm256_permute2x128_si256(s2, s6, 0x31);
+    r[7] = _mm256_permute2x128_si256(s3, s7, 0x31);
+}
+
+/// One block with a row per vector: the row pass runs on the transpose, so
+/// both passes are lane-wise butterflies over all eight rows or columns.
+__attribute__((target("avx2")))
+void fdct2DIntAvx2(CoefficientBlock& block)
+{
+    __m256i rows[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&block[i * 8]));
+        rows[i] = _mm256_slli_epi32(_mm256_cvtepi16_epi32(samples), PASS1_BITS);
+    }
+
+    transpose8x8(rows);
+    fdct1DInt(rows);
+    transpose8x8(rows);
+    fdct1DInt(rows);
+
+    const __m256i half = _mm256_set1_epi32(1 << (PASS1_BITS - 1));
+    for (int i = 0; i < 8; ++i)
+    {
+        __m256i row = _mm256_srai_epi32(_mm256_add_epi32(rows[i], half), PASS1_BITS);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(row, row), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&block[i * 8]), _mm256_castsi256_si128(packed));
+    }
+}
+
+const bool cpuHasAvx2 = __builtin_cpu_supports("avx2");
+#endif // FDCT_INT_HAVE_AVX2_KERNEL
+
+} // namespace
+
+void FDCT_2D_int(CoefficientBlock& block)
+{
+#ifdef FDCT_INT_HAVE_AVX2_KERNEL
+    if (cpuHasAvx2)
+    {
+        fdct2DIntAvx2(block);
+        return;
+    }
+#endif // FDCT_INT_HAVE_AVX2_KERNEL
+
+    int32_t work[64];
+    for (size_t i = 0; i < 64; ++i)
+    {
+        work[i] = static_cast<int32_t>(block[i]) * (1 << PASS1_BITS);
+    }
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        fdct1DInt(work + i * 8, 1);
+    }
+    for (size_t i = 0; i < 8; ++i)
+    {
+        fdct1DInt(work + i, 8);
+    }
+
+    for (size_t i = 0; i < 64; ++i)
+    {
+        block[i] = static_cast<int16_t>(descale(work[i], PASS1_BITS));
+    }
+}
@@ -0,0 +1,164 @@
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FDCT_HAVE_AVX_KERNEL 1
+#endif
+
+#ifdef FDCT_HAVE_AVX_KERNEL
+namespace
+{
+
+/// Transposes the 8x8 float matrix held in rows r[0..7].
+__attribute__((target("avx")))
+inline void transpose8x8(__m256 r[8])
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+/// One 1D FDCT over eight lanes. x[k] holds sample k of eight independent
+/// vectors; the operation order matches FDCT_2D so results are identical.
+__attribute__((target("avx")))
+inline void fdct1D(__m256 x[8])
+{
+    const __m256 cC4 = _mm256_set1_ps(FDCT_C4);
+    const __m256 cC6 = _mm256_set1_ps(FDCT_C6);
+    const __m256 cC2MinusC6 = _mm256_set1_ps(FDCT_C2_MINUS_C6);
+    const __m256 cC2PlusC6 = _mm256_set1_ps(FDCT_C2_PLUS_C6);
+    const __m256 zero = _mm256_setzero_ps();
+
+    // Phase 1
+    __m256 p1_0 = _mm256_add_ps(x[0], x[7]);
+    __m256 p1_1 = _mm256_add_ps(x[1], x[6]);
+    __m256 p1_2 = _mm256_add_ps(x[2], x[5]);
+    __m256 p1_3 = _mm256_add_ps(x[3], x[4]);
+    __m256 p1_4 = _mm256_sub_ps(x[3], x[4]);
+    __m256 p1_5 = _mm256_sub_ps(x[2], x[5]);
+    __m256 p1_6 = _mm256_sub_ps(x[1], x[6]);
+    __m256 p1_7 = _mm256_sub_ps(x[0], x[7]);
+    // Phase 2
+    __m256 p2_0 = _mm256_add_ps(p1_0, p1_3);
+    __m256 p2_1 = _mm256_add_ps(p1_1, p1_2);
+    __m256 p2_2 = _mm256_sub_ps(p1_1, p1_2);
+    __m256 p2_3 = _mm256_sub_ps(p1_0, p1_3);
+    __m256 p2_4 = _mm256_sub_ps(zero, _mm256_add_ps(p1_4, p1_5));
+    __m256 p2_5 = _mm256_add_ps(p1_5, p1_6);
+    __m256 p2_6 = _mm256_add_ps(p1_6, p1_7);
+    __m256 p2_7 = p1_7;
+    // Phase 3
+    __m256 p3_0 = _mm256_add_ps(p2_0, p2_1);
+    __m256 p3_1 = _mm256_sub_ps(p2_0, p2_1);
+    __m256 p3_2 = _mm256_add_ps(p2_2, p2_3);
+    // Phase 4
+    __m256 p4_2 = _mm256_mul_ps(p3_2, cC4);
+    __m256 sum46 = _mm256_add_ps(p2_4, p2_6);
+    __m256 p4_4 = _mm256_sub_ps(zero, _mm256_add_ps(_mm256_mul_ps(sum46, cC6), _mm256_mul_ps(p2_4, cC2MinusC6)));
+    __m256 p4_5 = _mm256_mul_ps(p2_5, cC4);
+    __m256 p4_6 = _mm256_sub_ps(_mm256_mul_ps(p2_6, cC2PlusC6), _mm256_mul_ps(sum46, cC6));
+    // Phase 5
+    __m256 p5_2 = _mm256_add_ps(p4_2, p2_3);
+    __m256 p5_3 = _mm256_sub_ps(p2_3, p4_2);
+    __m256 p5_5 = _mm256_add_ps(p4_5, p2_7);
+    __m256 p5_7 = _mm256_sub_ps(p2_7, p4_5);
+    // Phase 6 and 7
+    x[0] = _mm256_mul_ps(p3_0, _mm256_set1_ps(FDCT_SCALE[0]));
+    x[1] = _mm256_mul_ps(p3_1, _mm256_set1_ps(FDCT_SCALE[1]));
+    x[2] = _mm256_mul_ps(p5_2, _mm256_set1_ps(FDCT_SCALE[2]));
+    x[3] = _mm256_mul_ps(p5_3, _mm256_set1_ps(FDCT_SCALE[3]));
+    x[4] = _mm256_mul_ps(_mm256_add_ps(p4_4, p5_7), _mm256_set1_ps(FDCT_SCALE[4]));
+    x[5] = _mm256_mul_ps(_mm256_add_ps(p5_5, p4_6), _mm256_set1_ps(FDCT_SCALE[5]));
+    x[6] = _mm256_mul_ps(_mm256_sub_ps(p5_5, p4_6), _mm256_set1_ps(FDCT_SCALE[6]));
+    x[7] = _mm256_mul_ps(_mm256_sub_ps(p5_7, p4_4), _mm256_set1_ps(FDCT_SCALE[7]));
+}
+
+/// Eight blocks with one block per lane: coefficient (i, j) of all eight
+/// blocks lives in v[i][j], so rows and columns are both plain lane-wise
+/// butterflies and the only shuffling is the transpose on load and store.
+__attribute__((target("avx")))
+void fdct2D_x8_avx(float blocks[8][8][8])
+{
+    __m256 v[8][8];
+
+    for (int i = 0; i < 8; ++i)
+    {
+        for (int b = 0; b < 8; ++b)
+        {
+            v[i][b] = _mm256_loadu_ps(blocks[b][i]);
+        }
+        transpose8x8(v[i]);
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        fdct1D(v[i]);
+    }
+
+    for (int j = 0; j < 8; ++j)
+    {
+        __m256 column[8];
+        for (int i = 0; i < 8; ++i)
+        {
+            column[i] = v[i][j];
+        }
+        fdct1D(column);
+        for (int i = 0; i < 8; ++i)
+        {
+            v[i][j] = column[i];
+        }
+    }
+
+    for (int i = 0; i < 8; ++i)
+    {
+        transpose8x8(v[i]);
+        for (int b = 0; b < 8; ++b)
+        {
+            _mm256_storeu_ps(blocks[b][i], v[i][b]);
+        }
+    }
+}
+
+const bool cpuHasAvx = __builtin_cpu_supports("avx");
+
+} // namespace
+#endif // FDCT_HAVE_AVX_KERNEL
+
+void FDCT_2D_x8(float blocks[8][8][8])
+{
+#ifdef FDCT_HAVE_AVX_KERNEL
+    if (cpuHasAvx)
+    {
+        fdct2D_x8_avx(blocks);
+        return;
+    }
+#endif // FDCT_HAVE_AVX_KERNEL
+
+    for (int b = 0; b < 8; ++b)
+    {
+        FDCT_2D(blocks[b]);
+    }
+}
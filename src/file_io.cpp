@@ -0,0 +1,191 @@
+#include "file_io.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path, bool hugePages)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (0 > fd)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (0 != fstat(fd, &info))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // An empty file is valid input; mmap() just cannot map zero bytes.
+    length = static_cast<size_t>(info.st_size);
+    if (0 < length)
+    {
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == mapping)
+        {
+            length = 0;
+            ::close(fd);
+            return false;
+        }
+
+        bytes = static_cast<uint8_t*>(mapping);
+        madvise(mapping, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        if (hugePages)
+        {
+            // Only a hint: most file systems ignore it for file mappings.
+            madvise(mapping, length, MADV_HUGEPAGE);
+        }
+#else
+        (void)hugePages;
+#endif
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (nullptr != bytes)
+    {
+        munmap(bytes, length);
+    }
+    bytes = nullptr;
+    length = 0;
+}
+
+OutputWriter::OutputWriter()
+    : buffer(BUFFER_SIZE), used(0), written(0), fd(-1), failed(false)
+{
+}
+
+OutputWriter::~OutputWriter()
+{
+    close();
+}
+
+bool OutputWriter::open(const std::string& path)
+{
+    close();
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    used = 0;
+    written = 0;
+    failed = 0 > fd;
+    return !failed;
+}
+
+bool OutputWriter::open(ChunkSink chunkSink)
+{
+    close();
+
+    sink = std::move(chunkSink);
+    used = 0;
+    written = 0;
+    failed = !sink;
+    return !failed;
+}
+
+bool OutputWriter::close()
+{
+    if (sink)
+    {
+        flush();
+        sink = nullptr;
+        return !failed;
+    }
+    if (0 > fd)
+    {
+        return !failed;
+    }
+
+    flush();
+    if (0 != ::close(fd))
+    {
+        failed = true;
+    }
+    fd = -1;
+    return !failed;
+}
+
+void OutputWriter::write(const void* data, size_t size)
+{
+    // An empty vector's data() may be null, which memcpy must not see.
+    if (0 == size)
+    {
+        return;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    if (used + size <= buffer.size())
+    {
+        std::memcpy(buffer.data() + used, bytes, size);
+        used += size;
+        return;
+    }
+
+    // Anything at least as large as the buffer is written straight from
+    // the caller's memory instead of being copied through it.
+    flush();
+    if (size >= buffer.size())
+    {
+        writeThrough(bytes, size);
+        written += size;
+        return;
+    }
+
+    std::memcpy(buffer.data(), bytes, size);
+    used = size;
+}
+
+void OutputWriter::flush()
+{
+    writeThrough(buffer.data(), used);
+    written += used;
+    used = 0;
+}
+
+void OutputWriter::writeThrough(const uint8_t* data, size_t size)
+{
+    if (sink)
+    {
+        failed = failed || (0 < size && !sink(data, size));
+        return;
+    }
+    while (0 < size && !failed)
+    {
+        ssize_t result = ::write(fd, data, size);
+        if (0 > result)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+        data += result;
+        size -= static_cast<size_t>(result);
+    }
+}
+
+void discardOutput(OutputWriter& outputFile, const std::string& path)
+{
+    outputFile.close();
+    std::error_code error;
+    fs::remove(path, error);
+}
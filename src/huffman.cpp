@@ -1,104 +1,214 @@
 #include "utils.h"
 
-void deleteHuffmanTree(HuffmanNode* root)
+void buildCodeLengths(const HuffmanHistogram& frequencies, unsigned maxLength, HuffmanCodeTable& codes)
 {
-    if (!root) return;
-    deleteHuffmanTree(root->left);
-    deleteHuffmanTree(root->right);
-    delete root;
-}
-
-HuffmanNode* buildHuffmanTree(const std::unordered_map<uint8_t, size_t>& frequencies)
-{
-    std::priority_queue<HuffmanNode*, std::vector<HuffmanNode*>, Compare> pq;
+    for (auto& code : codes)
+    {
+        code = {0, 0};
+    }
 
-    for (const auto& pair : frequencies)
+    // Used symbols sorted by ascending frequency; ties keep symbol order so
+    // the result is deterministic.
+    uint16_t sorted[256];
+    size_t n = 0;
+    for (uint16_t symbol = 0; symbol < 256; ++symbol)
     {
-        pq.push(new HuffmanNode(pair.first, pair.second));
+        if (0 != frequencies[symbol])
+        {
+            sorted[n++] = symbol;
+        }
     }
+    std::stable_sort(sorted, sorted + n, [&frequencies](uint16_t a, uint16_t b)
+    {
+        return frequencies[a] < frequencies[b];
+    });
 
-    while (1 < pq.size())
+    if (2 >= n)
     {
-        HuffmanNode* left = pq.top(); pq.pop();
-        HuffmanNode* right = pq.top(); pq.pop();
+        for (size_t i = 0; i < n; ++i)
+        {
+            codes[sorted[i]].length = 1;
+        }
+        return;
+    }
 
-        HuffmanNode* parent = new HuffmanNode(0, left->frequency + right->frequency);
-        parent->left = left;
-        parent->right = right;
+    // Package-merge. Level maxLength holds the leaves; every shallower level
+    // merges the leaves with pairs packaged from the level below. Because
+    // leaves enter every level in the same sorted order, the leaves chosen at
+    // a level are always a prefix of `sorted`, so one leaf/package flag per
+    // list item is all that has to be kept for the backward pass.
+    const size_t maxItems = 2 * 256;
+    uint64_t weights[2][maxItems];
+    bool isLeaf[HUFFMAN_MAX_CODE_LENGTH + 1][maxItems];
+    size_t levelSize[HUFFMAN_MAX_CODE_LENGTH + 1];
 
-        pq.push(parent);
+    maxLength = std::min<unsigned>(maxLength, HUFFMAN_MAX_CODE_LENGTH);
+
+    uint64_t* current = weights[maxLength & 1];
+    for (size_t i = 0; i < n; ++i)
+    {
+        current[i] = frequencies[sorted[i]];
+        isLeaf[maxLength][i] = true;
+    }
+    levelSize[maxLength] = n;
+
+    for (unsigned level = maxLength - 1; level >= 1; --level)
+    {
+        const uint64_t* below = weights[(level + 1) & 1];
+        uint64_t* merged = weights[level & 1];
+        size_t packages = levelSize[level + 1] / 2;
+        size_t leaf = 0;
+        size_t package = 0;
+        size_t count = 0;
+
+        while (leaf < n || package < packages)
+        {
+            uint64_t packageWeight = package < packages ? below[2 * package] + below[2 * package + 1] : 0;
+            if (package >= packages || (leaf < n && frequencies[sorted[leaf]] <= packageWeight))
+            {
+                merged[count] = frequencies[sorted[leaf++]];
+                isLeaf[level][count++] = true;
+            }
+            else
+            {
+                merged[count] = packageWeight;
+                isLeaf[level][count++] = false;
+                ++package;
+            }
+        }
+        levelSize[level] = count;
     }
 
-    return pq.top();
+    // An optimal code selects the 2n - 2 cheapest items of the top level;
+    // every package taken pulls its two children from the level below.
+    size_t take = 2 * n - 2;
+    for (unsigned level = 1; level <= maxLength && 0 < take; ++level)
+    {
+        size_t leaves = 0;
+        for (size_t i = 0; i < take; ++i)
+        {
+            leaves += isLeaf[level][i] ? 1 : 0;
+        }
+        for (size_t i = 0; i < leaves; ++i)
+        {
+            codes[sorted[i]].length++;
+        }
+        take = 2 * (take - leaves);
+    }
 }
 
-void buildHuffmanCodes(HuffmanNode* root, std::string currentCode, std::unordered_map<uint8_t, std::string>& codes)
+void assignCanonicalCodes(HuffmanCodeTable& codes)
 {
-    if (!root) return;
+    uint16_t lengthCount[33] = {0};
+    for (const auto& code : codes)
+    {
+        lengthCount[code.length]++;
+    }
+    lengthCount[0] = 0;
 
-    if (!root->left && !root->right)
+    // First code of each length, as in DEFLATE: codes of one length are
+    // consecutive and ordered by symbol value.
+    uint32_t nextCode[33] = {0};
+    uint32_t code = 0;
+    for (int length = 1; length <= 32; ++length)
     {
-        codes[root->data] = currentCode;
-        return;
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
     }
 
-    buildHuffmanCodes(root->left, currentCode + '0', codes);
-    buildHuffmanCodes(root->right, currentCode + '1', codes);
+    for (auto& entry : codes)
+    {
+        if (0 != entry.length)
+        {
+            entry.bits = nextCode[entry.length]++;
+        }
+    }
 }
 
-std::string encodeData(const std::vector<uint8_t>& data, const std::unordered_map<uint8_t, std::string>& codes)
+void writeCodeLengths(const HuffmanCodeTable& codes, uint8_t* header)
 {
-    std::string encodedData;
-    for (uint8_t byte : data)
+    // Two lengths per byte, hence the 15-bit limit.
+    for (uint16_t i = 0; i < 256; i += 2)
     {
-        encodedData += codes.at(byte);
+        header[i / 2] = static_cast<uint8_t>((codes[i].length & 0xF) | ((codes[i + 1].length & 0xF) << 4));
     }
-
-    return encodedData;
 }
 
-std::vector<uint8_t> compressData(const std::string& bitstream)
+void readCodeLengths(const uint8_t* header, HuffmanCodeTable& codes)
 {
-    std::vector<uint8_t> compressedData;
-    for (size_t i = 0; i < bitstream.size(); i += 8)
+    for (uint16_t i = 0; i < 256; i += 2)
     {
-        std::bitset<8> byte(bitstream.substr(i, 8));
-        compressedData.push_back(static_cast<uint8_t>(byte.to_ulong()));
+        codes[i] = {0, static_cast<uint8_t>(header[i / 2] & 0xF)};
+        codes[i + 1] = {0, static_cast<uint8_t>(header[i / 2] >> 4)};
     }
-
-    return compressedData;
 }
 
-std::vector<uint8_t> encodeHuffman(const std::vector<uint8_t>& data, std::vector<uint8_t>& header)
+size_t encodedSizeBits(const HuffmanHistogram& frequencies, const HuffmanCodeTable& codes)
 {
-    std::unordered_map<uint8_t, size_t> frequencies;
-
-    for (uint8_t byte : data)
+    size_t totalBits = 0;
+    for (size_t symbol = 0; symbol < frequencies.size(); ++symbol)
     {
-        frequencies[byte]++;
+        totalBits += frequencies[symbol] * codes[symbol].length;
     }
+    return totalBits;
+}
 
-    HuffmanNode* root = buildHuffmanTree(frequencies);
-
-    std::unordered_map<uint8_t, std::string> codes;
-
-    buildHuffmanCodes(root, "", codes);
-
-    // Step 4: Limit Huffman code lengths to 15 bits (16 levels)
-    //limitHuffmanCodeLengths(codes);
-
-    header.resize(128, 0);
-    for (uint16_t i = 0; i < 255; i += 2)
+bool HuffmanDecodeTable::build(const uint8_t* header)
+{
+    HuffmanCodeTable codes;
+    readCodeLengths(header, codes);
+    assignCanonicalCodes(codes);
+
+    const Entry invalid = {0, INVALID_LENGTH};
+    primary.fill(invalid);
+    overflow.clear();
+    valid = false;
+
+    const unsigned overflowBits = MAX_BITS - PRIMARY_BITS;
+    bool anyCode = false;
+    for (uint16_t symbol = 0; symbol < 256; ++symbol)
     {
-        uint8_t len1 = codes.count(i) ? codes[i].size() : 0;
-        uint8_t len2 = codes.count(i + 1) ? codes[i + 1].size() : 0;
-        header[i / 2] = (len1 & 0xF) | ((len2 & 0xF) << 4);
+        const HuffmanCode& code = codes[symbol];
+        if (0 == code.length)
+        {
+            continue;
+        }
+        if (code.bits >> code.length)
+        {
+            // Oversubscribed lengths: the canonical code ran out of room.
+            return false;
+        }
+        anyCode = true;
+
+        if (code.length <= PRIMARY_BITS)
+        {
+            uint32_t first = code.bits << (PRIMARY_BITS - code.length);
+            uint32_t count = 1u << (PRIMARY_BITS - code.length);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                primary[first + i] = {symbol, code.length};
+            }
+        }
+        else
+        {
+            uint32_t prefix = code.bits >> (code.length - PRIMARY_BITS);
+            if (0 != primary[prefix].length)
+            {
+                primary[prefix] = {static_cast<uint16_t>(overflow.size()), 0};
+                overflow.resize(overflow.size() + (1u << overflowBits), invalid);
+            }
+
+            uint32_t suffixBits = code.length - PRIMARY_BITS;
+            uint32_t suffix = code.bits & ((1u << suffixBits) - 1);
+            uint32_t first = primary[prefix].value + (suffix << (overflowBits - suffixBits));
+            uint32_t count = 1u << (overflowBits - suffixBits);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                overflow[first + i] = {symbol, code.length};
+            }
+        }
     }
 
-    std::string bitstream = encodeData(data, codes);
-
-    std::vector<uint8_t> compressedData = compressData(bitstream);
-
-    deleteHuffmanTree(root);
-    return compressedData;
-}
\ No newline at end of file
+    valid = anyCode;
+    return valid;
+}
@@ -1,5 +1,7 @@
 #include <utils.h>
 
+#include <thread>
+
 int main(int argc, char *argv[])
 {
     if (1 >= argc)
@@ -15,17 +17,237 @@ int main(int argc, char *argv[])
     {
         printHelp();
     }
-    else if(CommandUsed::COMPRESS == usedCommand)
+    else if(CommandUsed::COMPRESS == usedCommand || CommandUsed::BATCH == usedCommand)
     {
-        if (5 != argc)
+        const bool batch = CommandUsed::BATCH == usedCommand;
+        bool threadsGiven = false;
+        EncoderOptions options;
+        StatsMode statsMode = StatsMode::OFF;
+        std::vector<std::string> positional;
+        for (int i = 2; i < argc; ++i)
         {
-            std::cerr << "Usage: -c [quality 1-100] [input path] [output path]" <<std::endl;
+            std::string arg = argv[i];
+            if (parseStatsOption(arg, statsMode))
+            {
+                continue;
+            }
+            if ("-j" == arg)
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cerr << "Option -j needs a thread count!" << std::endl;
+                    return 1;
+                }
+                try
+                {
+                    int threads = std::stoi(argv[++i]);
+                    if (1 > threads)
+                    {
+                        throw std::out_of_range("threads");
+                    }
+                    options.threads = static_cast<unsigned>(threads);
+                    threadsGiven = true;
+                }
+                catch (...)
+                {
+                    std::cerr << "Invalid thread count. It must be a positive integer!" << std::endl;
+                    return 1;
+                }
+            }
+            else if (0 == arg.rfind("--dct=", 0))
+            {
+                std::string mode = arg.substr(6);
+                if ("int" == mode)
+                {
+                    options.dct = DctMode::INTEGER;
+                }
+                else if ("float" == mode)
+                {
+                    options.dct = DctMode::FLOAT;
+                }
+                else
+                {
+                    std::cerr << "Invalid DCT mode. Use --dct=int or --dct=float!" << std::endl;
+                    return 1;
+                }
+            }
+            else if ("--entropy" == arg || 0 == arg.rfind("--entropy=", 0))
+            {
+                std::string mode;
+                if ("--entropy" == arg)
+                {
+                    mode = i + 1 < argc ? argv[++i] : "";
+                }
+                else
+                {
+                    mode = arg.substr(10);
+                }
+
+                if ("huffman" == mode)
+                {
+                    options.entropy = EntropyMode::HUFFMAN;
+                }
+                else if ("rans" == mode)
+                {
+                    options.entropy = EntropyMode::RANS;
+                }
+                else
+                {
+                    std::cerr << "Invalid entropy coder. Use --entropy huffman or rans!" << std::endl;
+                    return 1;
+                }
+            }
+            else if ("-s" == arg)
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cerr << "Option -s needs a frame size!" << std::endl;
+                    return 1;
+                }
+                std::string size = argv[++i];
+                size_t separator = size.find_first_of("xX");
+                try
+                {
+                    if (std::string::npos == separator)
+                    {
+                        throw std::invalid_argument("size");
+                    }
+                    int width = std::stoi(size.substr(0, separator));
+                    int height = std::stoi(size.substr(separator + 1));
+                    if (1 > width || 65535 < width || 1 > height || 65535 < height)
+                    {
+                        throw std::out_of_range("size");
+                    }
+                    options.geometry.width = static_cast<size_t>(width);
+                    options.geometry.height = static_cast<size_t>(height);
+                }
+                catch (...)
+                {
+                    std::cerr << "Invalid frame size. Use -s WxH with sides from 1 to 65535!" << std::endl;
+                    return 1;
+                }
+            }
+            else if ("--chroma" == arg || 0 == arg.rfind("--chroma=", 0))
+            {
+                std::string mode;
+                if ("--chroma" == arg)
+                {
+                    mode = i + 1 < argc ? argv[++i] : "";
+                }
+                else
+                {
+                    mode = arg.substr(9);
+                }
+
+                if ("444" == mode)
+                {
+                    options.geometry.chroma = ChromaMode::CHROMA_444;
+                }
+                else if ("422" == mode)
+                {
+                    options.geometry.chroma = ChromaMode::CHROMA_422;
+                }
+                else if ("420" == mode)
+                {
+                    options.geometry.chroma = ChromaMode::CHROMA_420;
+                }
+                else
+                {
+                    std::cerr << "Invalid chroma mode. Use --chroma 444, 422 or 420!" << std::endl;
+                    return 1;
+                }
+            }
+            else if ("--index" == arg)
+            {
+                options.writeIndex = true;
+            }
+            else if ("--skip" == arg || 0 == arg.rfind("--skip=", 0))
+            {
+                std::string threshold;
+                if ("--skip" == arg)
+                {
+                    threshold = i + 1 < argc ? argv[++i] : "";
+                }
+                else
+                {
+                    threshold = arg.substr(7);
+                }
+
+                try
+                {
+                    int sad = std::stoi(threshold);
+                    if (0 > sad || BLOCK_SIZE * BLOCK_SIZE * 255 < sad)
+                    {
+                        throw std::out_of_range("skip");
+                    }
+                    options.skipThreshold = sad;
+                }
+                catch (...)
+                {
+                    std::cerr << "Invalid skip threshold. Use --skip SAD with SAD from 0 to 16320!" << std::endl;
+                    return 1;
+                }
+            }
+            else if ("--target-bytes" == arg || "--bitrate" == arg || "--fps" == arg)
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cerr << "Option " << arg << " needs a value!" << std::endl;
+                    return 1;
+                }
+                try
+                {
+                    std::string value = argv[++i];
+                    size_t parsed = 0;
+                    unsigned long long number = std::stoull(value, &parsed);
+                    if (0 == number || value.size() != parsed || '-' == value[0])
+                    {
+                        throw std::out_of_range("rate");
+                    }
+
+                    if ("--target-bytes" == arg)
+                    {
+                        options.targetBytes = number;
+                    }
+                    else if ("--bitrate" == arg)
+                    {
+                        options.bitrate = number * 1000;
+                    }
+                    else if (1000 >= number)
+                    {
+                        options.fps = static_cast<unsigned>(number);
+                    }
+                    else
+                    {
+                        throw std::out_of_range("fps");
+                    }
+                }
+                catch (...)
+                {
+                    std::cerr << "Invalid value for " << arg << ". It must be a positive integer!" << std::endl;
+                    return 1;
+                }
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (batch && 3 != positional.size())
+        {
+            std::cerr << "Usage: -b [quality 1-100] [input directory or manifest] [output directory] [compress options]" << std::endl;
+            return 1;
+        }
+        if (3 != positional.size())
+        {
+            std::cerr << "Usage: -c [quality 1-100] [input path] [output path] [-s WxH] [--chroma 444|422|420] [-j threads] [--dct=int|float] [--entropy huffman|rans] [--index] [--skip SAD] [--target-bytes N | --bitrate kbps [--fps N]] [--stats[=json]]" <<std::endl;
             return 1;
         }
         int quality = 0;
         try
         {
-            quality = std::stoi(argv[2]);
+            quality = std::stoi(positional[0]);
         }
         catch (...)
         {
@@ -38,9 +260,41 @@ int main(int argc, char *argv[])
             std::cerr << "Quality must be between 1 and 100." << std::endl;
             return 1;
         }
+        if (0 != options.targetBytes && 0 != options.bitrate)
+        {
+            std::cerr << "Use either --target-bytes or --bitrate, not both." << std::endl;
+            return 1;
+        }
+        options.quality = quality;
+
+        if (batch)
+        {
+            if (!threadsGiven)
+            {
+                options.threads = std::max(1u, std::thread::hardware_concurrency());
+            }
 
-        std::string inputFile = argv[3];
-        std::string outputFile = argv[4];
+            std::vector<BatchJob> jobs;
+            if (!collectBatchJobs(positional[1], positional[2], jobs))
+            {
+                return 1;
+            }
+
+            RunStats stats;
+            if (StatsMode::OFF != statsMode)
+            {
+                options.stats = &stats;
+            }
+            bool succeeded = compressBatch(jobs, options);
+            if (StatsMode::OFF != statsMode)
+            {
+                stats.report(std::cerr, StatsMode::JSON == statsMode);
+            }
+            return succeeded ? 0 : 1;
+        }
+
+        std::string inputFile = positional[1];
+        std::string outputFile = positional[2];
 
         fs::path inputPath(inputFile);
         fs::path outputPath(outputFile);
@@ -75,20 +329,86 @@ int main(int argc, char *argv[])
         std::cout << "Compressing..." << std::endl
                 << "Quality: " << quality << std::endl
                 << "Input: " << inputFile << std::endl
-                << "Output: " << outputFile << "\n";
+                << "Output: " << outputFile << "\n"
+                << "Size: " << options.geometry.width << "x" << options.geometry.height << std::endl
+                << "Chroma: " << (ChromaMode::CHROMA_420 == options.geometry.chroma ? "4:2:0"
+                                  : ChromaMode::CHROMA_422 == options.geometry.chroma ? "4:2:2" : "4:4:4") << std::endl
+                << "Threads: " << options.threads << std::endl
+                << "DCT: " << (DctMode::INTEGER == options.dct ? "int" : "float") << std::endl
+                << "Entropy: " << (EntropyMode::RANS == options.entropy ? "rans" : "huffman") << std::endl
+                << "Index: " << (options.writeIndex ? "yes" : "no") << std::endl
+                << "Skip: " << (0 > options.skipThreshold ? "off" : "SAD <= " + std::to_string(options.skipThreshold))
+                << std::endl;
+        if (0 != options.targetBytes)
+        {
+            std::cout << "Target: " << options.targetBytes << " bytes" << std::endl;
+        }
+        else if (0 != options.bitrate)
+        {
+            std::cout << "Target: " << options.bitrate / 1000 << " kbit/s at " << options.fps << " fps" << std::endl;
+        }
 
-        compress(inputPath, outputPath, quality);
+        RunStats stats;
+        if (StatsMode::OFF != statsMode)
+        {
+            options.stats = &stats;
+        }
+        bool succeeded = compress(inputPath, outputPath, options);
+        if (StatsMode::OFF != statsMode)
+        {
+            stats.report(std::cerr, StatsMode::JSON == statsMode);
+        }
+        return succeeded ? 0 : 1;
     }
     else if (CommandUsed::DECOMPRESS == usedCommand)
     {
-        if (argc != 4)
+        // Parallel decoding buffers whole groups, so it is only used on request.
+        unsigned threads = 1;
+        StatsMode statsMode = StatsMode::OFF;
+        std::vector<std::string> positional;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (parseStatsOption(arg, statsMode))
+            {
+                continue;
+            }
+            if ("-j" == arg)
+            {
+                if (i + 1 >= argc)
+                {
+                    std::cerr << "Option -j needs a thread count!" << std::endl;
+                    return 1;
+                }
+                try
+                {
+                    int count = std::stoi(argv[++i]);
+                    if (1 > count)
+                    {
+                        throw std::out_of_range("threads");
+                    }
+                    threads = static_cast<unsigned>(count);
+                }
+                catch (...)
+                {
+                    std::cerr << "Invalid thread count. It must be a positive integer!" << std::endl;
+                    return 1;
+                }
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (2 != positional.size())
         {
-            std::cerr << "Usage: -u [input path] [output path]" << std::endl;
+            std::cerr << "Usage: -u [input path] [output path] [-j threads] [--stats[=json]]" << std::endl;
             return 1;
         }
 
-        std::string inputFile = argv[2];
-        std::string outputFile = argv[3];
+        std::string inputFile = positional[0];
+        std::string outputFile = positional[1];
 
         fs::path inputPath(inputFile);
         fs::path outputPath(outputFile);
@@ -127,7 +447,90 @@ int main(int argc, char *argv[])
         std::cout << "Input file: " << inputPath << "\n";
         std::cout << "Output file: " << outputPath << "\n";
 
-        // TODO: Call decompression logic here
+        RunStats stats;
+        bool succeeded = decompress(inputPath, outputPath, threads, StatsMode::OFF != statsMode ? &stats : nullptr);
+        if (StatsMode::OFF != statsMode)
+        {
+            stats.report(std::cerr, StatsMode::JSON == statsMode);
+        }
+        return succeeded ? 0 : 1;
+    }
+    else if (CommandUsed::EXTRACT == usedCommand)
+    {
+        std::string range;
+        std::vector<std::string> positional;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if ("--frames" == arg && i + 1 < argc)
+            {
+                range = argv[++i];
+            }
+            else if (0 == arg.rfind("--frames=", 0))
+            {
+                range = arg.substr(9);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (range.empty() || 2 != positional.size())
+        {
+            std::cerr << "Usage: -x --frames A:B [input path] [output path]" << std::endl;
+            return 1;
+        }
+
+        size_t firstFrame = 0;
+        size_t endFrame = 0;
+        try
+        {
+            size_t separator = range.find(':');
+            if (std::string::npos == separator)
+            {
+                throw std::invalid_argument("range");
+            }
+            long long first = std::stoll(range.substr(0, separator));
+            long long end = std::stoll(range.substr(separator + 1));
+            if (0 > first || first >= end)
+            {
+                throw std::out_of_range("range");
+            }
+            firstFrame = static_cast<size_t>(first);
+            endFrame = static_cast<size_t>(end);
+        }
+        catch (...)
+        {
+            std::cerr << "Invalid frame range. Use --frames A:B with 0 <= A < B!" << std::endl;
+            return 1;
+        }
+
+        fs::path inputPath(positional[0]);
+        fs::path outputPath(positional[1]);
+
+        if (!inputPath.is_absolute() || !outputPath.is_absolute())
+        {
+            std::cerr << "You need to use absolute path!" << std::endl;
+            return 1;
+        }
+        if (!fs::exists(inputPath))
+        {
+            std::cerr << "Input file does not exist: " << inputPath << std::endl;
+            return 1;
+        }
+        if (".rgb" != inputPath.extension() || ".rgb" != outputPath.extension())
+        {
+            std::cerr << "Input and output files must have .rgb extension." << std::endl;
+            return 1;
+        }
+
+        std::cout << "Extracting...\n";
+        std::cout << "Frames: " << firstFrame << " to " << endFrame - 1 << "\n";
+        std::cout << "Input file: " << inputPath << "\n";
+        std::cout << "Output file: " << outputPath << "\n";
+
+        return extractFrames(inputPath, outputPath, firstFrame, endFrame) ? 0 : 1;
     }
     else
     {
@@ -0,0 +1,86 @@
+#include "utils.h"
+#include "file_io.h"
+#include "thread_pool.h"
+
+#include <future>
+#include <memory>
+
+/// Encodes the frames of one GOP. DPCM restarts at the first frame of the
+/// group, so this only depends on the input frames of the group itself.
+EncodedGroup encodeGroup(const uint8_t* frames, size_t groupIndex, uint32_t numFrames, const EncoderOptions& options)
+{
+    // Pool threads keep their buffers between groups; they only need new
+    // ones if the frame size changes.
+    thread_local EncoderBuffers buffers(options.geometry);
+    if (buffers.geometry != options.geometry)
+    {
+        buffers = EncoderBuffers(options.geometry);
+    }
+
+    size_t firstFrame = groupIndex * GOP_SIZE;
+    size_t lastFrame = std::min<size_t>(firstFrame + GOP_SIZE, numFrames);
+
+    EncodedGroup group(lastFrame - firstFrame);
+    for (size_t frameIndex = firstFrame; frameIndex < lastFrame; ++frameIndex)
+    {
+        const uint8_t* rgbFrame = frames + frameIndex * options.geometry.frameBytes();
+        encodeFrame(rgbFrame, frameIndex, options, buffers, group[frameIndex - firstFrame]);
+    }
+
+    return group;
+}
+
+bool compressGroupsParallel(const uint8_t* frames, OutputWriter& outputFile, uint32_t numFrames,
+                            const EncoderOptions& options, FrameIndex& index)
+{
+    const size_t numGroups = (numFrames + GOP_SIZE - 1) / GOP_SIZE;
+    // Bounds the number of encoded groups waiting for the writer, so memory
+    // stays proportional to the thread count rather than the clip length.
+    const size_t maxInFlight = 2 * options.threads;
+
+    ThreadPool pool(options.threads);
+    std::deque<std::future<EncodedGroup>> inFlight;
+    size_t nextGroup = 0;
+    size_t frameIndex = 0;
+
+    try
+    {
+        while (frameIndex < numFrames)
+        {
+            while (nextGroup < numGroups && inFlight.size() < maxInFlight)
+            {
+                auto task = std::make_shared<std::packaged_task<EncodedGroup()>>(
+                    [frames, groupIndex = nextGroup, numFrames, &options]()
+                    {
+                        return encodeGroup(frames, groupIndex, numFrames, options);
+                    });
+                inFlight.push_back(task->get_future());
+                pool.submit([task]() { (*task)(); });
+                ++nextGroup;
+            }
+
+            // Groups are written strictly in order, so each nextFrameOffset
+            // can still be derived from the writer's position.
+            EncodedGroup group = inFlight.front().get();
+            inFlight.pop_front();
+
+            for (const auto& encodedFrame : group)
+            {
+                writeFrameRecord(outputFile, frameIndex, numFrames, encodedFrame, index, options.stats);
+                ++frameIndex;
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        // Let the workers finish before the futures go away.
+        for (auto& pending : inFlight)
+        {
+            pending.wait();
+        }
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,102 @@
+#include "utils.h"
+
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+template <size_t... Quality>
+constexpr std::array<Quantizer, sizeof...(Quality)> makeQuantizers(const unsigned char (&quantTable)[8][8],
+                                                                  std::index_sequence<Quality...>)
+{
+    return {{Quantizer(quantTable, static_cast<int>(Quality) + 1)...}};
+}
+
+/// Every quality of one standard table, evaluated by the compiler.
+template <const unsigned char (&QuantTable)[8][8]>
+const Quantizer& standardQuantizer(int quality)
+{
+    static constexpr std::array<Quantizer, 100> quantizers =
+        makeQuantizers(QuantTable, std::make_index_sequence<100>());
+    return quantizers[quality - 1];
+}
+
+} // namespace
+
+const Quantizer& componentQuantizer(int component, int quality)
+{
+    return 0 == component ? standardQuantizer<TABEL_QUANTIZARE_Y>(quality)
+                          : standardQuantizer<TABEL_QUANTIZARE_CbCr>(quality);
+}
+
+void Quantizer::quantize(const float block[8][8], int16_t* coefficients) const
+{
+    const float* scaledBlock = &block[0][0];
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128i upper = _mm_set1_epi16(COEFFICIENT_LIMIT);
+    const __m128i lower = _mm_set1_epi16(-COEFFICIENT_LIMIT);
+
+    // Eight coefficients per iteration: round half away from zero by
+    // truncating |x / d| + 0.5, restore the sign, then pack to int16 and
+    // clamp.
+    for (; i < 64; i += 8)
+    {
+        __m128i quantized[2];
+        for (size_t k = 0; k < 2; ++k)
+        {
+            __m128 scaled = _mm_mul_ps(_mm_loadu_ps(scaledBlock + i + 4 * k), _mm_load_ps(&reciprocal[i + 4 * k]));
+            __m128i magnitude = _mm_cvttps_epi32(_mm_add_ps(_mm_andnot_ps(signMask, scaled), half));
+            __m128i sign = _mm_srai_epi32(_mm_castps_si128(scaled), 31);
+            quantized[k] = _mm_sub_epi32(_mm_xor_si128(magnitude, sign), sign);
+        }
+
+        __m128i packed = _mm_packs_epi32(quantized[0], quantized[1]);
+        packed = _mm_max_epi16(_mm_min_epi16(packed, upper), lower);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(coefficients + i), packed);
+    }
+#endif // __SSE2__
+
+    // The same rounding without SSE2; the magnitude is clamped before the
+    // conversion, which the saturating pack does above.
+    for (; i < 64; ++i)
+    {
+        float scaled = scaledBlock[i] * reciprocal[i];
+        float magnitude = std::min(std::fabs(scaled) + 0.5f, static_cast<float>(COEFFICIENT_LIMIT));
+        int16_t value = static_cast<int16_t>(magnitude);
+        coefficients[i] = std::signbit(scaled) ? static_cast<int16_t>(-value) : value;
+    }
+}
+
+void Quantizer::quantize(const CoefficientBlock& block, int16_t* coefficients) const
+{
+    // Branch-free so the compiler can vectorize it.
+    for (size_t i = 0; i < 64; ++i)
+    {
+        int32_t coefficient = block[i];
+        uint64_t magnitude = static_cast<uint64_t>(std::abs(coefficient)) + divisor[i] / 2;
+        int32_t value = static_cast<int32_t>((magnitude * multiplier[i]) >> MULTIPLIER_BITS);
+        value = coefficient < 0 ? -value : value;
+        coefficients[i] = static_cast<int16_t>(std::max<int32_t>(-COEFFICIENT_LIMIT,
+                                                                 std::min<int32_t>(COEFFICIENT_LIMIT, value)));
+    }
+}
+
+void Quantizer::dequantize(const int16_t* coefficients, float block[8][8]) const
+{
+    for (size_t i = 0; i < 8; ++i)
+    {
+        for (size_t j = 0; j < 8; ++j)
+        {
+            block[i][j] = static_cast<float>(coefficients[i * 8 + j] * divisor[i * 8 + j]);
+        }
+    }
+}
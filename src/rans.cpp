@@ -0,0 +1,516 @@
+#include "utils.h"
+#include "bitstream.h"
+#include "coefficient_scan.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+using namespace coefficient_scan;
+
+/// Frequencies of a table sum to RANS_TOTAL. States are 32 bits and kept in
+/// [RANS_LOW, 2^32) by moving 16-bit words in and out, at most one per
+/// symbol, so renormalizing never loops.
+constexpr unsigned SCALE_BITS = RansDecodeTable::SCALE_BITS;
+constexpr uint32_t RANS_TOTAL = 1u << SCALE_BITS;
+constexpr uint32_t RANS_LOW = 1u << 16;
+
+/// Symbol i of a stream is coded with state i % RANS_STATES, so consecutive
+/// symbols do not wait on each other's state update.
+constexpr unsigned RANS_STATES = 4;
+static_assert(0 == (RANS_STATES & (RANS_STATES - 1)), "the state count must be a power of two");
+
+/// Presence bitmap of a serialized frequency table; the frequencies of the
+/// present symbols follow it.
+constexpr size_t PRESENCE_BYTES = 256 / 8;
+
+/// Frequency of each symbol and the start of its slot range.
+struct RansEncodeTable
+{
+    uint16_t frequency[256];
+    uint16_t start[256];
+};
+
+/// Scales symbol counts to frequencies summing to RANS_TOTAL, keeping every
+/// symbol that occurs at 1 or more. A table without symbols stays empty.
+void normalizeFrequencies(const HuffmanHistogram& counts, RansEncodeTable& table)
+{
+    std::fill(std::begin(table.frequency), std::end(table.frequency), 0);
+    std::fill(std::begin(table.start), std::end(table.start), 0);
+
+    uint64_t total = 0;
+    for (size_t count : counts)
+    {
+        total += count;
+    }
+    if (0 == total)
+    {
+        return;
+    }
+
+    int assigned = 0;
+    uint8_t order[256];
+    unsigned used = 0;
+    for (unsigned symbol = 0; symbol < 256; ++symbol)
+    {
+        if (0 != counts[symbol])
+        {
+            uint64_t scaled = counts[symbol] * RANS_TOTAL / total;
+            table.frequency[symbol] = static_cast<uint16_t>(std::max<uint64_t>(1, scaled));
+            assigned += table.frequency[symbol];
+            order[used++] = static_cast<uint8_t>(symbol);
+        }
+    }
+
+    // Rounding down leaves slots over, which go to the most frequent
+    // symbol. Raising rare symbols to 1 can overshoot instead; then the
+    // most frequent symbols give some back, never going below 1.
+    std::sort(order, order + used, [&](uint8_t a, uint8_t b) { return table.frequency[a] > table.frequency[b]; });
+    int excess = assigned - static_cast<int>(RANS_TOTAL);
+    if (0 > excess)
+    {
+        table.frequency[order[0]] = static_cast<uint16_t>(table.frequency[order[0]] - excess);
+    }
+    for (unsigned i = 0; i < used && 0 < excess; ++i)
+    {
+        int take = std::min(excess, table.frequency[order[i]] - 1);
+        table.frequency[order[i]] = static_cast<uint16_t>(table.frequency[order[i]] - take);
+        excess -= take;
+    }
+
+    uint32_t start = 0;
+    for (unsigned symbol = 0; symbol < 256; ++symbol)
+    {
+        table.start[symbol] = static_cast<uint16_t>(start);
+        start += table.frequency[symbol];
+    }
+}
+
+/// Bytes writeFrequencies() produces for `table`.
+size_t frequencyBytes(const RansEncodeTable& table)
+{
+    size_t bytes = PRESENCE_BYTES;
+    for (uint16_t frequency : table.frequency)
+    {
+        bytes += 0 == frequency ? 0 : (frequency <= 128 ? 1 : 2);
+    }
+    return bytes;
+}
+
+/// Writes the presence bitmap and then frequency - 1 of each present
+/// symbol: one byte below 128, two big-endian bytes with the top bit set
+/// otherwise. Returns the bytes written.
+size_t writeFrequencies(const RansEncodeTable& table, uint8_t* out)
+{
+    std::memset(out, 0, PRESENCE_BYTES);
+    size_t pos = PRESENCE_BYTES;
+    for (unsigned symbol = 0; symbol < 256; ++symbol)
+    {
+        unsigned frequency = table.frequency[symbol];
+        if (0 == frequency)
+        {
+            continue;
+        }
+        out[symbol / 8] |= static_cast<uint8_t>(1u << (7 - symbol % 8));
+        --frequency;
+        if (frequency < 128)
+        {
+            out[pos++] = static_cast<uint8_t>(frequency);
+        }
+        else
+        {
+            out[pos++] = static_cast<uint8_t>(0x80 | (frequency >> 8));
+            out[pos++] = static_cast<uint8_t>(frequency);
+        }
+    }
+    return pos;
+}
+
+/// Bytes of the encoded frame after the frequency tables: the AC symbol
+/// count and the sizes of the DC and AC streams. The DC symbol count is
+/// the number of coded blocks.
+constexpr size_t STREAM_HEADER_BYTES = 3 * sizeof(uint32_t);
+
+/// Bytes of the final states that start every stream.
+constexpr size_t STATE_BYTES = RANS_STATES * sizeof(uint32_t);
+
+inline void writeLittleEndian32(uint32_t value, uint8_t* out)
+{
+    for (size_t i = 0; i < sizeof(uint32_t); ++i)
+    {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint32_t readLittleEndian32(const uint8_t* in)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < sizeof(uint32_t); ++i)
+    {
+        value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+/// Codes `count` symbols of one table last to first, symbol i with state
+/// i % RANS_STATES, writing backwards from `end`. Each symbol moves at most
+/// one word out of its state, so 2 * count + STATE_BYTES bytes before `end`
+/// are enough. Returns the start of the stream.
+uint8_t* encodeStream(const uint8_t* symbols, size_t count, const RansEncodeTable& table, uint8_t* end)
+{
+    uint32_t states[RANS_STATES];
+    std::fill(states, states + RANS_STATES, RANS_LOW);
+    uint8_t* out = end;
+    for (size_t i = count; i-- > 0;)
+    {
+        const uint8_t symbol = symbols[i];
+        const uint32_t frequency = table.frequency[symbol];
+        uint32_t& state = states[i & (RANS_STATES - 1)];
+        // The bound is 2^32 for a symbol that has the whole table, which
+        // then never moves a word out; it does not fit in 32 bits.
+        if (state >= (uint64_t{RANS_LOW >> SCALE_BITS} << 16) * frequency)
+        {
+            const uint16_t word = static_cast<uint16_t>(state);
+            out -= sizeof(word);
+            std::memcpy(out, &word, sizeof(word));
+            state >>= 16;
+        }
+        state = ((state / frequency) << SCALE_BITS) + state % frequency + table.start[symbol];
+    }
+    for (unsigned i = RANS_STATES; i-- > 0;)
+    {
+        out -= sizeof(uint32_t);
+        writeLittleEndian32(states[i], out);
+    }
+    return out;
+}
+
+/// Takes the next symbol out of `state`; renormalizing is left to the
+/// caller.
+inline uint8_t decodeSymbol(const RansDecodeTable& table, uint32_t& state)
+{
+    const uint32_t slot = state & (RANS_TOTAL - 1);
+    const uint8_t symbol = table.slots[slot];
+    const uint32_t range = table.ranges[symbol];
+    state = (range & 0xFFFF) * (state >> SCALE_BITS) + slot - (range >> 16);
+    return symbol;
+}
+
+/// Moves a word into `state` if it fell below RANS_LOW. Whether it does
+/// depends on the data, so it is computed rather than branched on; the
+/// caller makes sure two bytes are left.
+inline void renormalize(uint32_t& state, const uint8_t*& next)
+{
+    uint16_t word;
+    std::memcpy(&word, next, sizeof(word));
+    const uint32_t refill = state < RANS_LOW;
+    state = (state << (16 * refill)) | (word & (0u - refill));
+    next += 2 * refill;
+}
+
+/// Decodes the `count` symbols of one stream into `symbols`. The states
+/// are independent, so their lookups and multiplies overlap. False if the
+/// stream is malformed or does not end exactly where the encoder started.
+bool decodeStream(const uint8_t* data, size_t size, const RansDecodeTable& table, size_t count, uint8_t* symbols)
+{
+    if (STATE_BYTES > size || (0 != count && !table.valid))
+    {
+        return false;
+    }
+    uint32_t states[RANS_STATES];
+    for (unsigned i = 0; i < RANS_STATES; ++i)
+    {
+        states[i] = readLittleEndian32(data + i * sizeof(uint32_t));
+    }
+    const uint8_t* next = data + STATE_BYTES;
+    const uint8_t* const end = data + size;
+
+    // One symbol per state and iteration, with the states in locals so
+    // they stay in registers.
+    static_assert(4 == RANS_STATES, "the loop below decodes four states");
+    uint32_t state0 = states[0];
+    uint32_t state1 = states[1];
+    uint32_t state2 = states[2];
+    uint32_t state3 = states[3];
+    size_t i = 0;
+    for (; i + RANS_STATES <= count && end - next >= static_cast<ptrdiff_t>(2 * RANS_STATES); i += RANS_STATES)
+    {
+        symbols[i] = decodeSymbol(table, state0);
+        symbols[i + 1] = decodeSymbol(table, state1);
+        symbols[i + 2] = decodeSymbol(table, state2);
+        symbols[i + 3] = decodeSymbol(table, state3);
+        renormalize(state0, next);
+        renormalize(state1, next);
+        renormalize(state2, next);
+        renormalize(state3, next);
+    }
+    states[0] = state0;
+    states[1] = state1;
+    states[2] = state2;
+    states[3] = state3;
+
+    // The last few symbols, whose words may run up to the end.
+    for (; i < count; ++i)
+    {
+        uint32_t& state = states[i & (RANS_STATES - 1)];
+        symbols[i] = decodeSymbol(table, state);
+        if (state < RANS_LOW)
+        {
+            if (end - next < 2)
+            {
+                return false;
+            }
+            renormalize(state, next);
+        }
+    }
+
+    return next == end && std::all_of(states, states + RANS_STATES, [](uint32_t state) { return RANS_LOW == state; });
+}
+
+/// Ends each decoded stream. It is neither a DC nor an AC symbol, so a
+/// frame that asks for more symbols than it has fails on it.
+constexpr uint8_t END_OF_SYMBOLS = 0xFF;
+static_assert(MAX_DC_SIZE < END_OF_SYMBOLS && MAX_AC_SIZE < (END_OF_SYMBOLS & 0xF), "the end marker must be invalid");
+
+/// Symbols for parseCoefficients() from the decoded DC and AC streams and
+/// the magnitude bits.
+struct RansSymbolSource
+{
+    const uint8_t* symbols[2];
+    BitReader magnitudes;
+
+    inline bool symbol(unsigned table, uint16_t& symbol)
+    {
+        symbol = *symbols[table]++;
+        return true;
+    }
+
+    inline int magnitude(unsigned size)
+    {
+        if (0 == size)
+        {
+            return 0;
+        }
+        magnitudes.refill();
+        return readMagnitude(magnitudes, size);
+    }
+};
+
+} // namespace
+
+size_t RansDecodeTable::read(const uint8_t* data, size_t size)
+{
+    valid = false;
+    if (PRESENCE_BYTES > size)
+    {
+        return 0;
+    }
+
+    size_t pos = PRESENCE_BYTES;
+    uint32_t start = 0;
+    for (unsigned symbol = 0; symbol < 256; ++symbol)
+    {
+        if (0 == (data[symbol / 8] & (1u << (7 - symbol % 8))))
+        {
+            continue;
+        }
+        if (pos >= size)
+        {
+            return 0;
+        }
+        uint32_t frequency = data[pos++];
+        if (frequency & 0x80)
+        {
+            if (pos >= size)
+            {
+                return 0;
+            }
+            frequency = ((frequency & 0x7F) << 8) | data[pos++];
+        }
+        ++frequency;
+        if (start + frequency > RANS_TOTAL)
+        {
+            return 0;
+        }
+        std::fill(slots.begin() + start, slots.begin() + start + frequency, static_cast<uint8_t>(symbol));
+        ranges[symbol] = start << 16 | frequency;
+        start += frequency;
+    }
+
+    // A table without symbols belongs to a frame without coded blocks.
+    if (0 != start && RANS_TOTAL != start)
+    {
+        return 0;
+    }
+    valid = 0 != start;
+    return pos;
+}
+
+size_t ransPayloadSize(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry)
+{
+    HuffmanHistogram counts[2] = {};
+    size_t magnitudeBitCount = 0;
+    scanCoefficients(coefficients, skip, geometry, [&](unsigned table, uint8_t symbol, uint32_t, unsigned size)
+    {
+        counts[table][symbol]++;
+        magnitudeBitCount += size;
+    });
+
+    // The coder stays within a few bytes of the information content of the
+    // scaled frequencies, which is close enough for rate control.
+    size_t bytes = (skip ? skipFlagBytes(geometry) : 0) + STREAM_HEADER_BYTES + 2 * STATE_BYTES;
+    double codeBits = 0.0;
+    for (unsigned table = 0; table < 2; ++table)
+    {
+        RansEncodeTable model;
+        normalizeFrequencies(counts[table], model);
+        bytes += frequencyBytes(model);
+        for (unsigned symbol = 0; symbol < 256; ++symbol)
+        {
+            if (0 != counts[table][symbol])
+            {
+                codeBits += static_cast<double>(counts[table][symbol])
+                            * (SCALE_BITS - std::log2(static_cast<double>(model.frequency[symbol])));
+            }
+        }
+    }
+    return bytes + static_cast<size_t>(std::ceil(codeBits / 8)) + (magnitudeBitCount + 7) / 8;
+}
+
+void ransEncodeCoefficients(const int16_t* coefficients, const uint8_t* skip, const FrameGeometry& geometry,
+                            EncodedFrame& encodedFrame)
+{
+    // First pass: symbol statistics, and the symbols themselves, since rANS
+    // codes them last to first.
+    static thread_local std::vector<uint8_t> symbols[2];
+    symbols[DC_TABLE].clear();
+    symbols[AC_TABLE].clear();
+    HuffmanHistogram counts[2] = {};
+    size_t magnitudeBitCount = 0;
+    scanCoefficients(coefficients, skip, geometry, [&](unsigned table, uint8_t symbol, uint32_t, unsigned size)
+    {
+        counts[table][symbol]++;
+        symbols[table].push_back(symbol);
+        magnitudeBitCount += size;
+    });
+
+    RansEncodeTable tables[2];
+    normalizeFrequencies(counts[DC_TABLE], tables[DC_TABLE]);
+    normalizeFrequencies(counts[AC_TABLE], tables[AC_TABLE]);
+
+    const size_t skipBytes = skip ? skipFlagBytes(geometry) : 0;
+    std::vector<uint8_t>& header = encodedFrame.header;
+    header.assign(skipBytes + frequencyBytes(tables[DC_TABLE]) + frequencyBytes(tables[AC_TABLE])
+                  + STREAM_HEADER_BYTES, 0);
+    if (skip)
+    {
+        packSkipFlags(skip, geometry, header.data());
+    }
+    size_t headerOffset = skipBytes;
+    headerOffset += writeFrequencies(tables[DC_TABLE], header.data() + headerOffset);
+    headerOffset += writeFrequencies(tables[AC_TABLE], header.data() + headerOffset);
+
+    // Each stream is written backwards into the room after the ones before
+    // it, then moved down behind them.
+    std::vector<uint8_t>& data = encodedFrame.data;
+    const size_t magnitudeBytes = (magnitudeBitCount + 7) / 8;
+    data.resize(2 * (symbols[DC_TABLE].size() + symbols[AC_TABLE].size() + STATE_BYTES) + magnitudeBytes
+                + sizeof(uint32_t));
+    size_t streamBytes[2];
+    size_t dataOffset = 0;
+    for (unsigned table = 0; table < 2; ++table)
+    {
+        uint8_t* end = data.data() + dataOffset + 2 * symbols[table].size() + STATE_BYTES;
+        uint8_t* start = encodeStream(symbols[table].data(), symbols[table].size(), tables[table], end);
+        streamBytes[table] = static_cast<size_t>(end - start);
+        std::memmove(data.data() + dataOffset, start, streamBytes[table]);
+        dataOffset += streamBytes[table];
+    }
+    writeLittleEndian32(static_cast<uint32_t>(symbols[AC_TABLE].size()), header.data() + headerOffset);
+    writeLittleEndian32(static_cast<uint32_t>(streamBytes[DC_TABLE]), header.data() + headerOffset + 4);
+    writeLittleEndian32(static_cast<uint32_t>(streamBytes[AC_TABLE]), header.data() + headerOffset + 8);
+
+    // Second pass: the magnitude bits, in symbol order.
+    BitWriter writer(data.data() + dataOffset);
+    scanCoefficients(coefficients, skip, geometry, [&](unsigned, uint8_t, uint32_t bits, unsigned size)
+    {
+        writer.put(bits, size);
+    });
+    data.resize(dataOffset + writer.flush());
+
+    FrameStats& stats = encodedFrame.stats;
+    stats.codedBlocks = symbols[DC_TABLE].size();
+    stats.symbols = symbols[DC_TABLE].size() + symbols[AC_TABLE].size();
+    stats.codeBits = 8 * static_cast<uint64_t>(dataOffset);
+    stats.dcCodes = static_cast<uint16_t>(std::count_if(std::begin(tables[DC_TABLE].frequency),
+                                                        std::end(tables[DC_TABLE].frequency),
+                                                        [](uint16_t frequency) { return 0 != frequency; }));
+    stats.acCodes = static_cast<uint16_t>(std::count_if(std::begin(tables[AC_TABLE].frequency),
+                                                        std::end(tables[AC_TABLE].frequency),
+                                                        [](uint16_t frequency) { return 0 != frequency; }));
+    stats.reusedTables = 0;
+}
+
+bool ransDecodeCoefficients(const uint8_t* payload, size_t size, const FrameGeometry& geometry, uint8_t* skip,
+                            RansDecodeTable tables[2], int16_t* coefficients)
+{
+    const size_t skipBytes = skip ? skipFlagBytes(geometry) : 0;
+    if (skipBytes > size)
+    {
+        return false;
+    }
+    size_t codedBlocks = skip ? unpackSkipFlags(payload, geometry, skip) : geometry.totalBlocks();
+    size_t pos = skipBytes;
+
+    for (unsigned table = 0; table < 2; ++table)
+    {
+        size_t tableBytes = tables[table].read(payload + pos, size - pos);
+        if (0 == tableBytes)
+        {
+            return false;
+        }
+        pos += tableBytes;
+    }
+
+    // A block has at most 63 AC symbols, which bounds what a corrupt count
+    // can make us allocate.
+    if (STREAM_HEADER_BYTES > size - pos)
+    {
+        return false;
+    }
+    const size_t counts[2] = {codedBlocks, readLittleEndian32(payload + pos)};
+    const size_t streamBytes[2] = {readLittleEndian32(payload + pos + 4), readLittleEndian32(payload + pos + 8)};
+    pos += STREAM_HEADER_BYTES;
+    if (63 * codedBlocks < counts[AC_TABLE] || streamBytes[DC_TABLE] > size - pos
+        || streamBytes[AC_TABLE] > size - pos - streamBytes[DC_TABLE])
+    {
+        return false;
+    }
+
+    static thread_local std::vector<uint8_t> symbols[2];
+    for (unsigned table = 0; table < 2; ++table)
+    {
+        symbols[table].resize(counts[table] + 1);
+        symbols[table][counts[table]] = END_OF_SYMBOLS;
+        if (!decodeStream(payload + pos, streamBytes[table], tables[table], counts[table], symbols[table].data()))
+        {
+            return false;
+        }
+        pos += streamBytes[table];
+    }
+
+    RansSymbolSource source{{symbols[DC_TABLE].data(), symbols[AC_TABLE].data()},
+                            BitReader(payload + pos, size - pos)};
+    if (!parseCoefficients(geometry, skip, coefficients, source))
+    {
+        return false;
+    }
+
+    // Every decoded symbol has to be used.
+    return source.symbols[DC_TABLE] == symbols[DC_TABLE].data() + counts[DC_TABLE]
+           && source.symbols[AC_TABLE] == symbols[AC_TABLE].data() + counts[AC_TABLE]
+           && !source.magnitudes.overrun();
+}
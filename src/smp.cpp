@@ -0,0 +1,322 @@
+#include "smp.h"
+#include "thread_pool.h"
+
+#include <future>
+
+namespace
+{
+/// Decoded frames that decodeGroups() may hold for the sink; at 1080p this
+/// is five 32-frame groups.
+constexpr size_t DECODE_BUFFER_BYTES = size_t{1} << 30;
+}
+
+SmpEncoder::SmpEncoder()
+    : numFrames(0), frameIndex(0), active(false)
+{
+}
+
+bool SmpEncoder::begin(const EncoderOptions& clipOptions, uint32_t clipFrames, ChunkSink sink)
+{
+    const FrameGeometry& geometry = clipOptions.geometry;
+    if (0 == geometry.width || 65535 < geometry.width || 0 == geometry.height || 65535 < geometry.height
+        || 1 > clipOptions.quality || 100 < clipOptions.quality || !output.open(std::move(sink)))
+    {
+        active = false;
+        return false;
+    }
+
+    options = clipOptions;
+    options.frameBudget = rateControlBudget(options, clipFrames);
+    if (!buffers || buffers->geometry != geometry)
+    {
+        buffers = std::make_unique<EncoderBuffers>(geometry);
+    }
+    numFrames = clipFrames;
+    frameIndex = 0;
+    index.clear();
+    index.reserve(numFrames);
+
+    StreamHeader streamHeader;
+    streamHeader.width = static_cast<uint16_t>(geometry.width);
+    streamHeader.height = static_cast<uint16_t>(geometry.height);
+    streamHeader.numFrames = numFrames;
+    streamHeader.quality = options.quality;
+    streamHeader.chroma = geometry.chroma;
+    streamHeader.entropy = options.entropy;
+    writeStreamHeader(output, streamHeader);
+    output.flush();
+
+    active = output.good();
+    return active;
+}
+
+bool SmpEncoder::pushFrame(const uint8_t* rgbFrame)
+{
+    if (!active || frameIndex >= numFrames)
+    {
+        return false;
+    }
+
+    encodeFrame(rgbFrame, frameIndex, options, *buffers, encodedFrame);
+    writeFrameRecord(output, frameIndex, numFrames, encodedFrame, index, options.stats);
+    output.flush();
+    ++frameIndex;
+
+    active = output.good();
+    return active;
+}
+
+bool SmpEncoder::finish()
+{
+    if (!active)
+    {
+        output.close();
+        return false;
+    }
+    active = false;
+
+    // The last record's nextFrameOffset is only 0 if the count was met.
+    if (frameIndex != numFrames)
+    {
+        output.close();
+        return false;
+    }
+    if (options.writeIndex)
+    {
+        writeFrameIndex(output, index);
+    }
+    return output.close();
+}
+
+SmpDecoder::SmpDecoder()
+    : stream(nullptr), size(0), stats(nullptr), frameIndex(0)
+{
+}
+
+bool SmpDecoder::open(const uint8_t* data, size_t dataSize, RunStats* runStats)
+{
+    stream = nullptr;
+    frameIndex = 0;
+    message.clear();
+
+    if (!readStreamHeader(data, dataSize, header))
+    {
+        message = "Input is not an SMP stream";
+        return false;
+    }
+    if (0 == header.width || 0 == header.height)
+    {
+        message = "Invalid frame size " + std::to_string(header.width) + "x" + std::to_string(header.height);
+        return false;
+    }
+    if (1 > header.quality || 100 < header.quality)
+    {
+        message = "Invalid quality in stream header: " + std::to_string(header.quality);
+        return false;
+    }
+    if (ChromaMode::CHROMA_420 < header.chroma)
+    {
+        message = "Invalid chroma mode in stream header: " + std::to_string(static_cast<int>(header.chroma));
+        return false;
+    }
+    if (EntropyMode::RANS < header.entropy)
+    {
+        message = "Invalid entropy coder in stream header: " + std::to_string(static_cast<int>(header.entropy));
+        return false;
+    }
+
+    // Uses the index footer when the stream has one, the frame chain if not.
+    if (!readFrameIndex(data, dataSize, header, index))
+    {
+        message = "Corrupt frame records";
+        return false;
+    }
+
+    FrameGeometry geometry;
+    geometry.width = header.width;
+    geometry.height = header.height;
+    geometry.chroma = header.chroma;
+    if (!buffers || frameGeometry != geometry)
+    {
+        buffers = std::make_unique<DecoderBuffers>(geometry);
+    }
+    frameGeometry = geometry;
+    buffers->entropy = header.entropy;
+
+    stream = data;
+    size = dataSize;
+    stats = runStats;
+    return true;
+}
+
+bool SmpDecoder::nextFrame(uint8_t* rgbFrame)
+{
+    if (nullptr == stream || frameIndex >= header.numFrames)
+    {
+        return false;
+    }
+
+    if (!decodeFrameAt(frameIndex, *buffers, rgbFrame))
+    {
+        message = "Failed to decode frame " + std::to_string(frameIndex);
+        return false;
+    }
+    addFrameStats(frameIndex);
+    ++frameIndex;
+    return true;
+}
+
+bool SmpDecoder::decodeGroups(unsigned threads, const ChunkSink& sink)
+{
+    if (nullptr == stream)
+    {
+        return false;
+    }
+
+    // An intra frame restarts DPCM and carries its own code tables, so a
+    // group only depends on its own records. The first group carries on
+    // from the frames already decoded, with the session's buffers.
+    std::vector<size_t> groupStarts;
+    for (size_t frame = frameIndex; frame < header.numFrames; ++frame)
+    {
+        if (frame == frameIndex || FRAME_INTRA == (index[frame].frameType & FRAME_TYPE_MASK))
+        {
+            groupStarts.push_back(frame);
+        }
+    }
+    groupStarts.push_back(header.numFrames);
+
+    size_t longestGroup = 0;
+    for (size_t group = 1; group < groupStarts.size(); ++group)
+    {
+        longestGroup = std::max(longestGroup, groupStarts[group] - groupStarts[group - 1]);
+    }
+
+    const size_t frameBytes = frameGeometry.frameBytes();
+
+    // Decoded groups are held until the sink takes them, so streams whose
+    // intra frames lie further apart than the encoder puts them are decoded
+    // frame by frame on this thread, as are streams with nothing left.
+    if (1 >= threads || 0 == longestGroup || GOP_SIZE < longestGroup)
+    {
+        std::vector<uint8_t> rgbFrame(frameBytes);
+        while (frameIndex < header.numFrames)
+        {
+            if (!nextFrame(rgbFrame.data()))
+            {
+                return false;
+            }
+            if (!sink(rgbFrame.data(), frameBytes))
+            {
+                message = "Failed to write frame " + std::to_string(frameIndex - 1);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct DecodedGroup
+    {
+        std::vector<uint8_t> frames;
+        /// Frames decoded before the first failure.
+        size_t decoded = 0;
+    };
+
+    auto decodeGroup = [this, frameBytes](size_t first, size_t end, DecoderBuffers* groupBuffers)
+    {
+        std::unique_ptr<DecoderBuffers> ownBuffers;
+        if (nullptr == groupBuffers)
+        {
+            ownBuffers = std::make_unique<DecoderBuffers>(frameGeometry);
+            ownBuffers->entropy = header.entropy;
+            groupBuffers = ownBuffers.get();
+        }
+
+        DecodedGroup group;
+        group.frames.resize((end - first) * frameBytes);
+        while (first + group.decoded < end
+               && decodeFrameAt(first + group.decoded, *groupBuffers, group.frames.data() + group.decoded * frameBytes))
+        {
+            ++group.decoded;
+        }
+        return group;
+    };
+
+    const size_t numGroups = groupStarts.size() - 1;
+    // Bounds the groups waiting for the sink by their decoded size, so memory
+    // depends on neither the clip length nor the core count. One group is
+    // always allowed, and workers beyond the groups in flight would idle.
+    const size_t groupBytes = longestGroup * frameBytes;
+    const size_t maxInFlight = std::max<size_t>(1, std::min<size_t>(2 * threads, DECODE_BUFFER_BYTES / groupBytes));
+
+    ThreadPool pool(static_cast<unsigned>(std::min<size_t>(threads, maxInFlight)));
+    std::deque<std::future<DecodedGroup>> inFlight;
+    size_t nextGroup = 0;
+    bool succeeded = true;
+
+    while (succeeded && frameIndex < header.numFrames)
+    {
+        while (nextGroup < numGroups && inFlight.size() < maxInFlight)
+        {
+            DecoderBuffers* groupBuffers = 0 == nextGroup ? buffers.get() : nullptr;
+            auto task = std::make_shared<std::packaged_task<DecodedGroup()>>(
+                [decodeGroup, first = groupStarts[nextGroup], end = groupStarts[nextGroup + 1], groupBuffers]()
+                {
+                    return decodeGroup(first, end, groupBuffers);
+                });
+            inFlight.push_back(task->get_future());
+            pool.submit([task]() { (*task)(); });
+            ++nextGroup;
+        }
+
+        DecodedGroup group = inFlight.front().get();
+        inFlight.pop_front();
+
+        const size_t groupFrames = group.frames.size() / frameBytes;
+        for (size_t frame = 0; succeeded && frame < group.decoded; ++frame)
+        {
+            addFrameStats(frameIndex);
+            if (!sink(group.frames.data() + frame * frameBytes, frameBytes))
+            {
+                message = "Failed to write frame " + std::to_string(frameIndex);
+                succeeded = false;
+            }
+            ++frameIndex;
+        }
+        if (succeeded && group.decoded < groupFrames)
+        {
+            message = "Failed to decode frame " + std::to_string(frameIndex);
+            succeeded = false;
+        }
+    }
+
+    // Let the workers finish before the futures and buffers go away.
+    for (auto& pending : inFlight)
+    {
+        pending.wait();
+    }
+    return succeeded;
+}
+
+bool SmpDecoder::decodeFrameAt(size_t frame, DecoderBuffers& frameBuffers, uint8_t* rgbFrame) const
+{
+    // The quality is the last byte of the record prefix.
+    const FrameIndexEntry& record = index[frame];
+    int quality = stream[record.offset + FRAME_RECORD_PREFIX - 1];
+    return decodeFrame(stream + record.offset + FRAME_RECORD_PREFIX, record.size - FRAME_RECORD_PREFIX,
+                       record.frameType, quality, frameGeometry, frameBuffers, rgbFrame, stats);
+}
+
+void SmpDecoder::addFrameStats(size_t frame) const
+{
+    if (nullptr != stats)
+    {
+        const FrameIndexEntry& record = index[frame];
+        FrameStats frameStats;
+        frameStats.frameType = record.frameType & FRAME_TYPE_MASK;
+        frameStats.quality = stream[record.offset + FRAME_RECORD_PREFIX - 1];
+        frameStats.bytesIn = record.size;
+        frameStats.bytesOut = frameGeometry.frameBytes();
+        stats->addFrame(frameStats);
+    }
+}
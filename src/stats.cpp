@@ -0,0 +1,160 @@
+#include "stats.h"
+#include <algorithm>
+#include <iomanip>
+#include <sys/resource.h>
+#include <time.h>
+
+namespace
+{
+
+constexpr const char* STAGE_NAMES[] = {
+    "convert", "transform", "rate_control", "quantize", "entropy_encode",
+    "entropy_decode", "reconstruct", "color_output", "write",
+};
+static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == static_cast<size_t>(Stage::COUNT),
+              "every stage needs a name");
+
+inline double seconds(uint64_t nanoseconds)
+{
+    return static_cast<double>(nanoseconds) * 1e-9;
+}
+
+inline double timevalSeconds(const timeval& time)
+{
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) * 1e-6;
+}
+
+} // namespace
+
+uint64_t threadCpuNanoseconds()
+{
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return static_cast<uint64_t>(time.tv_sec) * 1000000000u + static_cast<uint64_t>(time.tv_nsec);
+}
+
+RunStats::RunStats()
+    : start(std::chrono::steady_clock::now())
+{
+}
+
+void RunStats::addStageTime(Stage stage, uint64_t wallNs, uint64_t cpuNs)
+{
+    StageTotals& totals = stages[static_cast<size_t>(stage)];
+    totals.wallNs.fetch_add(wallNs, std::memory_order_relaxed);
+    totals.cpuNs.fetch_add(cpuNs, std::memory_order_relaxed);
+    totals.calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RunStats::addFrame(const FrameStats& frame)
+{
+    std::lock_guard<std::mutex> lock(framesMutex);
+    frames.push_back(frame);
+}
+
+void RunStats::report(std::ostream& out, bool json) const
+{
+    auto wall = std::chrono::steady_clock::now() - start;
+    double wallSeconds = std::chrono::duration<double>(wall).count();
+
+    // ru_maxrss is in kilobytes on Linux.
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpuSeconds = timevalSeconds(usage.ru_utime) + timevalSeconds(usage.ru_stime);
+    long peakRssKiB = usage.ru_maxrss;
+
+    std::lock_guard<std::mutex> lock(framesMutex);
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t symbols = 0;
+    uint64_t codeBits = 0;
+    uint64_t tableCodes[2] = {0, 0};
+    uint64_t reusedTables = 0;
+    size_t codedFrames = 0;
+    for (const FrameStats& frame : frames)
+    {
+        bytesIn += frame.bytesIn;
+        bytesOut += frame.bytesOut;
+        symbols += frame.symbols;
+        codeBits += frame.codeBits;
+        tableCodes[0] += frame.dcCodes;
+        tableCodes[1] += frame.acCodes;
+        reusedTables += frame.reusedTables;
+        codedFrames += (0 != frame.symbols);
+    }
+    double averageCodeLength = 0 != symbols ? static_cast<double>(codeBits) / symbols : 0.0;
+
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed;
+
+    if (json)
+    {
+        out << std::setprecision(6)
+            << "{\"wall_seconds\":" << wallSeconds
+            << ",\"cpu_seconds\":" << cpuSeconds
+            << ",\"peak_rss_kib\":" << peakRssKiB
+            << ",\"bytes_in\":" << bytesIn
+            << ",\"bytes_out\":" << bytesOut
+            << ",\"average_code_length\":" << averageCodeLength
+            << ",\"stages\":{";
+        for (size_t stage = 0; stage < static_cast<size_t>(Stage::COUNT); ++stage)
+        {
+            const StageTotals& totals = stages[stage];
+            out << (0 == stage ? "" : ",") << "\"" << STAGE_NAMES[stage] << "\":{"
+                << "\"wall_seconds\":" << seconds(totals.wallNs.load())
+                << ",\"cpu_seconds\":" << seconds(totals.cpuNs.load())
+                << ",\"calls\":" << totals.calls.load() << "}";
+        }
+        out << "},\"frames\":[";
+        for (size_t frameIndex = 0; frameIndex < frames.size(); ++frameIndex)
+        {
+            const FrameStats& frame = frames[frameIndex];
+            out << (0 == frameIndex ? "" : ",")
+                << "{\"type\":" << static_cast<int>(frame.frameType)
+                << ",\"quality\":" << static_cast<int>(frame.quality)
+                << ",\"bytes_in\":" << frame.bytesIn
+                << ",\"bytes_out\":" << frame.bytesOut
+                << ",\"coded_blocks\":" << frame.codedBlocks
+                << ",\"symbols\":" << frame.symbols
+                << ",\"code_bits\":" << frame.codeBits
+                << ",\"dc_codes\":" << frame.dcCodes
+                << ",\"ac_codes\":" << frame.acCodes
+                << ",\"reused_tables\":" << static_cast<int>(frame.reusedTables) << "}";
+        }
+        out << "]}" << std::endl;
+    }
+    else
+    {
+        out << std::setprecision(3)
+            << "Wall time: " << wallSeconds << " s, CPU time: " << cpuSeconds << " s, peak RSS: "
+            << peakRssKiB << " KiB" << std::endl
+            << "Frames: " << frames.size() << ", bytes in: " << bytesIn << ", bytes out: " << bytesOut << std::endl;
+        if (0 != codedFrames)
+        {
+            out << "Average code length: " << averageCodeLength << " bits over " << symbols << " symbols" << std::endl
+                << "Average Huffman table size: " << static_cast<double>(tableCodes[0]) / codedFrames
+                << " DC codes, " << static_cast<double>(tableCodes[1]) / codedFrames << " AC codes" << std::endl
+                << "Huffman tables reused: " << reusedTables << " of " << 2 * frames.size() << std::endl;
+        }
+
+        // Stage times are summed over threads, so they can exceed the wall time.
+        out << std::left << std::setw(16) << "Stage" << std::right << std::setw(12) << "wall ms"
+            << std::setw(12) << "cpu ms" << std::setw(10) << "calls" << std::endl;
+        for (size_t stage = 0; stage < static_cast<size_t>(Stage::COUNT); ++stage)
+        {
+            const StageTotals& totals = stages[stage];
+            if (0 == totals.calls.load())
+            {
+                continue;
+            }
+            out << std::left << std::setw(16) << STAGE_NAMES[stage] << std::right
+                << std::setw(12) << seconds(totals.wallNs.load()) * 1e3
+                << std::setw(12) << seconds(totals.cpuNs.load()) * 1e3
+                << std::setw(10) << totals.calls.load() << std::endl;
+        }
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,219 @@
+#include "utils.h"
+#include "file_io.h"
+
+namespace
+{
+
+constexpr size_t INDEX_ENTRY_SIZE = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t);
+constexpr size_t INDEX_TRAILER_SIZE = sizeof(uint64_t) + 4;
+
+template <typename T>
+T readValue(const uint8_t* data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/// Reads the index footer, if the stream ends with a trailer pointing at a
+/// footer that covers every frame.
+bool readIndexFooter(const uint8_t* stream, size_t size, const StreamHeader& header, FrameIndex& index)
+{
+    if (size < StreamHeader::SIZE + 8 + INDEX_TRAILER_SIZE
+        || 0 != std::memcmp(stream + size - 4, "SMPX", 4))
+    {
+        return false;
+    }
+
+    uint64_t footerOffset = readValue<uint64_t>(stream + size - INDEX_TRAILER_SIZE);
+    uint64_t footerSize = frameIndexBytes(header.numFrames);
+    if (footerSize > size || footerOffset != size - footerSize || footerOffset < StreamHeader::SIZE
+        || 0 != std::memcmp(stream + footerOffset, "SMPI", 4)
+        || header.numFrames != readValue<uint32_t>(stream + footerOffset + 4))
+    {
+        return false;
+    }
+
+    index.resize(header.numFrames);
+    const uint8_t* entry = stream + footerOffset + 8;
+    for (FrameIndexEntry& frame : index)
+    {
+        frame.offset = readValue<uint64_t>(entry);
+        frame.size = readValue<uint32_t>(entry + 8);
+        frame.frameType = entry[12];
+        entry += INDEX_ENTRY_SIZE;
+
+        // The type is the first byte after the chain offset; the decoder picks
+        // group boundaries and frame decoding from the footer's copy.
+        if (frame.size < FRAME_RECORD_PREFIX || frame.offset < StreamHeader::SIZE
+            || frame.offset > footerOffset || frame.size > footerOffset - frame.offset
+            || frame.frameType != stream[frame.offset + sizeof(uint64_t)])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Builds the index by following the nextFrameOffset chain.
+bool walkFrameChain(const uint8_t* stream, size_t size, const StreamHeader& header, FrameIndex& index)
+{
+    if (size < StreamHeader::SIZE || header.numFrames > (size - StreamHeader::SIZE) / FRAME_RECORD_PREFIX)
+    {
+        return false;
+    }
+
+    index.resize(header.numFrames);
+    uint64_t position = StreamHeader::SIZE;
+
+    for (size_t frameIndex = 0; frameIndex < header.numFrames; ++frameIndex)
+    {
+        if (position + FRAME_RECORD_PREFIX > size)
+        {
+            return false;
+        }
+
+        uint64_t nextFrameOffset = readValue<uint64_t>(stream + position);
+        uint64_t end = (frameIndex + 1 < header.numFrames) ? nextFrameOffset : size;
+        if (end < position + FRAME_RECORD_PREFIX || end > size || UINT32_MAX < end - position)
+        {
+            return false;
+        }
+
+        index[frameIndex].offset = position;
+        index[frameIndex].size = static_cast<uint32_t>(end - position);
+        index[frameIndex].frameType = stream[position + sizeof(uint64_t)];
+        position = end;
+    }
+    return true;
+}
+
+} // namespace
+
+void writeStreamHeader(OutputWriter& outputFile, const StreamHeader& header)
+{
+    outputFile.write("SMP", 3);
+    outputFile.writeValue(header.width);
+    outputFile.writeValue(header.height);
+    outputFile.writeValue(header.numFrames);
+    outputFile.writeValue(header.quality);
+    outputFile.writeValue(static_cast<uint8_t>(static_cast<uint8_t>(header.chroma)
+                                               | static_cast<uint8_t>(header.entropy) << 4));
+}
+
+bool readStreamHeader(const uint8_t* stream, size_t size, StreamHeader& header)
+{
+    if (size < StreamHeader::SIZE || 0 != std::memcmp(stream, "SMP", 3))
+    {
+        return false;
+    }
+
+    header.width = readValue<uint16_t>(stream + 3);
+    header.height = readValue<uint16_t>(stream + 5);
+    header.numFrames = readValue<uint32_t>(stream + 7);
+    header.quality = readValue<int>(stream + 11);
+    header.chroma = static_cast<ChromaMode>(stream[15] & 0x0F);
+    header.entropy = static_cast<EntropyMode>(stream[15] >> 4);
+    return true;
+}
+
+uint64_t frameIndexBytes(size_t numFrames)
+{
+    return 8 + static_cast<uint64_t>(numFrames) * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE;
+}
+
+void writeFrameIndex(OutputWriter& outputFile, const FrameIndex& index)
+{
+    uint64_t footerOffset = outputFile.position();
+    uint32_t count = static_cast<uint32_t>(index.size());
+
+    outputFile.write("SMPI", 4);
+    outputFile.writeValue(count);
+    for (const FrameIndexEntry& frame : index)
+    {
+        outputFile.writeValue(frame.offset);
+        outputFile.writeValue(frame.size);
+        outputFile.writeValue(frame.frameType);
+    }
+    outputFile.writeValue(footerOffset);
+    outputFile.write("SMPX", 4);
+}
+
+bool readFrameIndex(const uint8_t* stream, size_t size, const StreamHeader& header, FrameIndex& index)
+{
+    return readIndexFooter(stream, size, header, index) || walkFrameChain(stream, size, header, index);
+}
+
+bool extractFrames(const std::string& inputFilePath, const std::string& outputFilePath, size_t firstFrame,
+                   size_t endFrame)
+{
+    MappedFile inputFile;
+    if (!inputFile.open(inputFilePath))
+    {
+        std::cerr << "Failed to open input file: " << inputFilePath << std::endl;
+        return false;
+    }
+
+    StreamHeader header;
+    FrameIndex index;
+    if (!readStreamHeader(inputFile.data(), inputFile.size(), header))
+    {
+        std::cerr << "Input file is not an SMP stream: " << inputFilePath << std::endl;
+        return false;
+    }
+    if (!readFrameIndex(inputFile.data(), inputFile.size(), header, index))
+    {
+        std::cerr << "Corrupt frame records in " << inputFilePath << std::endl;
+        return false;
+    }
+
+    endFrame = std::min<size_t>(endFrame, header.numFrames);
+    if (firstFrame >= endFrame)
+    {
+        std::cerr << "Frame range is empty; the stream has " << header.numFrames << " frames." << std::endl;
+        return false;
+    }
+
+    // Only whole groups can be copied: a DPCM frame needs every frame back
+    // to its group's intra frame.
+    size_t groupStart = firstFrame / GOP_SIZE * GOP_SIZE;
+    size_t groupEnd = std::min<size_t>((endFrame + GOP_SIZE - 1) / GOP_SIZE * GOP_SIZE, header.numFrames);
+
+    OutputWriter outputFile;
+    if (!outputFile.open(outputFilePath))
+    {
+        std::cerr << "Failed to open output file: " << outputFilePath << std::endl;
+        return false;
+    }
+
+    std::cout << "Copying frames " << groupStart << " to " << groupEnd - 1 << "..." << std::endl;
+
+    header.numFrames = static_cast<uint32_t>(groupEnd - groupStart);
+    writeStreamHeader(outputFile, header);
+
+    FrameIndex extracted;
+    extracted.reserve(header.numFrames);
+    for (size_t frameIndex = groupStart; frameIndex < groupEnd; ++frameIndex)
+    {
+        const FrameIndexEntry& frame = index[frameIndex];
+        uint64_t offset = outputFile.position();
+        uint64_t nextFrameOffset = (frameIndex + 1 < groupEnd) ? offset + frame.size : 0;
+
+        // Only the chain offset changes; type and payload are copied as is.
+        outputFile.writeValue(nextFrameOffset);
+        outputFile.write(inputFile.data() + frame.offset + sizeof(uint64_t), frame.size - sizeof(uint64_t));
+        extracted.push_back({offset, frame.size, frame.frameType});
+    }
+    writeFrameIndex(outputFile, extracted);
+
+    if (!outputFile.close())
+    {
+        std::cerr << "Failed to write output file: " << outputFilePath << std::endl;
+        discardOutput(outputFile, outputFilePath);
+        return false;
+    }
+
+    std::cout << "Extraction completed successfully!" << std::endl
+                << "Output file: " << outputFilePath << std::endl;
+    return true;
+}
@@ -0,0 +1,117 @@
+#include "thread_pool.h"
+
+namespace
+{
+
+/// The pool and deque of the calling thread, when it is a pool worker.
+thread_local const void* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threadCount)
+    : nextQueue(0), pending(0), stopping(false)
+{
+    if (0 == threadCount)
+    {
+        threadCount = 1;
+    }
+
+    queues.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i)
+    {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    workers.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    size_t queue = this == currentPool ? currentWorker
+                                       : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+        queues[queue]->tasks.push_back(std::move(task));
+    }
+
+    // Counted only once queued, so a worker that claims it always finds it.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++pending;
+    }
+    taskAvailable.notify_one();
+}
+
+bool ThreadPool::takeTask(size_t worker, std::function<void()>& task)
+{
+    {
+        WorkQueue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+        WorkQueue& victim = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t worker)
+{
+    currentPool = this;
+    currentWorker = worker;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this] { return stopping || 0 != pending; });
+            if (0 == pending)
+            {
+                return;
+            }
+            --pending;
+        }
+
+        // The claim above guarantees a queued task; another worker may be
+        // moving through the deques at the same time, so look until found.
+        std::function<void()> task;
+        while (!takeTask(worker, task))
+        {
+            std::this_thread::yield();
+        }
+        task();
+    }
+}
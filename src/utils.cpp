@@ -19,82 +19,106 @@ CommandUsed findCommand(std::string command)
         {
             comm = CommandUsed::DECOMPRESS;
         }
+        else if ("-x" == command || "/x" == command)
+        {
+            comm = CommandUsed::EXTRACT;
+        }
+        else if ("-b" == command || "/b" == command)
+        {
+            comm = CommandUsed::BATCH;
+        }
     }
 
     return comm;
 }
 
+/// Recognizes --stats and --stats=json; returns false for anything else.
+bool parseStatsOption(const std::string& arg, StatsMode& mode)
+{
+    if ("--stats" == arg || "--stats=text" == arg)
+    {
+        mode = StatsMode::TEXT;
+        return true;
+    }
+    if ("--stats=json" == arg)
+    {
+        mode = StatsMode::JSON;
+        return true;
+    }
+    return false;
+}
+
 void printHelp()
 {
     std::cout <<
-        "-c or /c [quality] [input filepath] [output filepath]\n"
-        "\tCompresses a CIF RGB24 file using a specified [quality] (1-100),\n"
+        "-c or /c [quality] [input filepath] [output filepath] [-s WxH] [--chroma 444|422|420]\n"
+        "        [-j threads] [--dct=int|float] [--entropy huffman|rans] [--index] [--skip SAD]\n"
+        "        [--target-bytes N | --bitrate kbps [--fps N]] [--stats[=json]]\n"
+        "\tCompresses a planar RGB24 file using a specified [quality] (1-100),\n"
         "\tfrom [input filepath] to [output filepath]\n"
-        "-u or /u [input filepath] [output filepath]\n"
-        "\tUncompresses a compressed file from [input filepath] to [output filepath]\n";
+        "\t-s WxH sets the frame size (default 352x288, CIF)\n"
+        "\t--chroma 422 or 420 stores Cb and Cr at half width, or half width and height\n"
+        "\t-j [threads] encodes independent 32-frame groups on [threads] workers\n"
+        "\t--dct=int uses the fixed-point transform for bit-exact output on any CPU;\n"
+        "\tits AVX2 kernel keeps 32-bit lanes, so it is no wider than the float one\n"
+        "\t--entropy rans codes symbols with interleaved rANS over per-frame frequency\n"
+        "\ttables instead of Huffman codes; smaller at low quality and faster to decode\n"
+        "\t--index appends a frame index so readers can seek without walking every frame\n"
+        "\t--skip SAD codes 8x8 blocks of inter frames whose sum of absolute differences\n"
+        "\tfrom their last coded version is at most SAD as a single skip flag\n"
+        "\t--target-bytes N or --bitrate kbps (at --fps, default 25) picks the quality of\n"
+        "\teach frame, up to [quality], so the stream fits the budget\n"
+        "-b or /b [quality] [input directory or manifest] [output directory] [compress options]\n"
+        "\tCompresses every .rgb file of a directory, or every path listed in a manifest\n"
+        "\t(one per line), into files of the same name in [output directory]. Clips are\n"
+        "\tsplit into 32-frame groups and shared by -j workers (default: all cores);\n"
+        "\taggregate throughput is printed at the end\n"
+        "-u or /u [input filepath] [output filepath] [-j threads] [--stats[=json]]\n"
+        "\tUncompresses a compressed file from [input filepath] to [output filepath]\n"
+        "\t-j [threads] decodes the groups between intra frames on [threads] workers\n"
+        "\t(default: 1) and writes the frames in order, holding up to 1 GiB of them\n"
+        "--stats prints per-stage wall and CPU times, frame sizes, Huffman table sizes,\n"
+        "\tthe average code length and peak memory to stderr; --stats=json as JSON\n"
+        "-x or /x --frames A:B [input filepath] [output filepath]\n"
+        "\tCopies the 32-frame groups holding frames A to B-1 of a compressed file\n"
+        "\tinto a new compressed file with an index, without re-encoding\n";
 }
 
 YCbCr rgbToYuv(const RGB& rgb)
 {
     YCbCr ycbcr;
-    ycbcr.y = FP_RGB2Y(rgb.r, rgb.g, rgb.b);
-    ycbcr.cb = FP_RGB2Cb(rgb.r, rgb.g, rgb.b);
-    ycbcr.cr = FP_RGB2Cr(rgb.r, rgb.g, rgb.b);
+    ycbcr.y = FIX_RGB2Y(rgb.r, rgb.g, rgb.b);
+    ycbcr.cb = FIX_RGB2Cb(rgb.r, rgb.g, rgb.b);
+    ycbcr.cr = FIX_RGB2Cr(rgb.r, rgb.g, rgb.b);
     return ycbcr;
 }
 
 RGB yuvToRgb(const YCbCr& ycbcr)
 {
     RGB rgb;
-    rgb.r = FP_YUV2R(ycbcr.y, ycbcr.cb, ycbcr.cr);
-    rgb.b = FP_YUV2B(ycbcr.y, ycbcr.cb, ycbcr.cr);
-    rgb.g = FP_YUV2G(ycbcr.y, ycbcr.cb, ycbcr.cr);
+    rgb.r = FIX_YUV2R(ycbcr.y, ycbcr.cb, ycbcr.cr);
+    rgb.b = FIX_YUV2B(ycbcr.y, ycbcr.cb, ycbcr.cr);
+    rgb.g = FIX_YUV2G(ycbcr.y, ycbcr.cb, ycbcr.cr);
 
     return rgb;
 }
 
-void vectorTo2DArray(const std::vector<float>& vec, float array[8][8])
+void loadBlock(const uint8_t* samples, float block[8][8])
 {
+    // Level shift so the DCT works on samples centred on zero.
     for (size_t i = 0; i < 8; ++i)
     {
         for (size_t j = 0; j < 8; ++j)
         {
-            array[i][j] = vec[i * 8 + j];
+            block[i][j] = samples[i * 8 + j] - 128.0f;
         }
     }
 }
 
-std::vector<uint8_t> recomposeFrame(const std::vector<std::array<std::array<float, 8>, 8>>& quantizedBlocks)
+void loadBlock(const uint8_t* samples, CoefficientBlock& block)
 {
-    std::vector<uint8_t> frame;
-#ifdef DEBUG_LARGE_BLOCK
-    std::cout << "Recomposing frame with " << quantizedBlocks.size() << " blocks\n";
-    std::cout << "Total size: " << quantizedBlocks.size() * 8 * 8 << " bytes\n";
-#endif //DEBUG_LARGE_BLOCK
-    frame.reserve(quantizedBlocks.size() * 8 * 8);
-
-    for(const auto& block :quantizedBlocks)
+    for (size_t i = 0; i < 64; ++i)
     {
-        for(const auto& row : block)
-        {
-            for(const auto& value : row)
-            {
-                frame.push_back(static_cast<uint8_t>(value));
-            }
-        }
+        block[i] = static_cast<int16_t>(samples[i] - 128);
     }
-    return frame;
 }
-
-std::array<std::array<float, 8>, 8> convertToStdArray(float var[8][8])
-{
-    std::array<std::array<float, 8>, 8> result;
-    for (size_t i = 0; i < 8; ++i)
-    {
-        for (size_t j = 0; j < 8; ++j)
-        {
-            result[i][j] = var[i][j];
-        }
-    }
-    return result;
-}
\ No newline at end of file